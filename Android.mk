@@ -10,4 +10,5 @@ LOCAL_C_INCLUDES += \
 	$(LOCAL_PATH)/../libplhw \
 	$(LOCAL_PATH)/../libplepaper
 LOCAL_STATIC_LIBRARIES := libplhw libplepaper libplutil libeglib
+LOCAL_SHARED_LIBRARIES := libz
 include $(BUILD_EXECUTABLE)
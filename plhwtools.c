@@ -21,6 +21,11 @@
 
 #include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <stdint.h>
 #include <assert.h>
 #include <unistd.h>
 #include <errno.h>
@@ -29,8 +34,17 @@
 #include <signal.h>
 #include <time.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <fcntl.h>
 #include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include <zlib.h>
+#if defined(__has_include)
+# if __has_include(<linux/gpio.h>)
+#  include <linux/gpio.h>
+# endif
+#endif
 
 #include <plsdk/plconfig.h>
 #include <libplepaper.h>
@@ -50,7 +64,10 @@ static const char LICENSE[] =
 static const char COPYRIGHT[] =
 	"Copyright (C) 2011, 2012, 2013 Plastic Logic Limited";
 
+struct command;
+
 struct ctx {
+	const struct command *commands;
 	struct plconfig *config;
 	struct cpld *cpld;
 	struct max17135 *max17135;
@@ -58,6 +75,10 @@ struct ctx {
 	struct dac5820 *dac;
 	struct adc11607 *adc;
 	struct eeprom *eeprom;
+	char *eeprom_mode;
+	unsigned eeprom_i2c_addr;
+	unsigned long eeprom_block_size;
+	unsigned long eeprom_page_size;
 	struct pbtn *pbtn;
 	struct plep *plep;
 };
@@ -73,6 +94,167 @@ struct switch_id {
 	int id;
 };
 
+/* All the device functions used by the commands, in the form
+ * OP(device, return_type, name, parameters, arguments, bytes) or
+ * VOP(device, name, parameters, arguments) when they return nothing and do
+ * not access the bus.  The bytes expression gives the number of data bytes
+ * transferred by each call, or 0 when not relevant. */
+#define HW_OPS(OP, VOP)							\
+	OP(cpld, struct cpld *, cpld_init,				\
+	   (const char *i2c_bus, unsigned i2c_addr),			\
+	   (i2c_bus, i2c_addr), 0)					\
+	VOP(cpld, cpld_free,						\
+	    (struct cpld *p), (p))					\
+	OP(cpld, int, cpld_get_version,					\
+	   (struct cpld *p), (p), 1)					\
+	OP(cpld, int, cpld_get_board_id,				\
+	   (struct cpld *p), (p), 1)					\
+	OP(cpld, size_t, cpld_get_data_size,				\
+	   (struct cpld *p), (p), 0)					\
+	OP(cpld, int, cpld_dump,					\
+	   (struct cpld *p, char *data, size_t size),			\
+	   (p, data, size), size)					\
+	OP(cpld, int, cpld_set_switch,					\
+	   (struct cpld *p, int sw, int on), (p, sw, on), 1)		\
+	OP(cpld, int, cpld_set_switches,				\
+	   (struct cpld *p, int mask, int on_mask),			\
+	   (p, mask, on_mask), 1)					\
+	OP(cpld, int, cpld_get_switch,					\
+	   (struct cpld *p, int sw), (p, sw), 1)			\
+	OP(max17135, struct max17135 *, max17135_init,			\
+	   (const char *i2c_bus, unsigned i2c_addr),			\
+	   (i2c_bus, i2c_addr), 0)					\
+	VOP(max17135, max17135_free,					\
+	    (struct max17135 *p), (p))					\
+	OP(max17135, int, max17135_get_prod_id,				\
+	   (struct max17135 *p), (p), 1)				\
+	OP(max17135, int, max17135_get_prod_rev,			\
+	   (struct max17135 *p), (p), 1)				\
+	OP(max17135, int, max17135_set_en,				\
+	   (struct max17135 *p, int id, int on), (p, id, on), 1)	\
+	OP(max17135, int, max17135_get_en,				\
+	   (struct max17135 *p, int id), (p, id), 1)			\
+	OP(max17135, int, max17135_set_timing,				\
+	   (struct max17135 *p, int n, int ms), (p, n, ms), 1)		\
+	OP(max17135, int, max17135_get_timings,				\
+	   (struct max17135 *p, char *t, int n), (p, t, n), n)		\
+	OP(max17135, int, max17135_set_timings,				\
+	   (struct max17135 *p, char *t, int n), (p, t, n), n)		\
+	OP(max17135, int, max17135_get_vcom,				\
+	   (struct max17135 *p, char *vcom), (p, vcom), 1)		\
+	OP(max17135, int, max17135_set_vcom,				\
+	   (struct max17135 *p, char vcom), (p, vcom), 1)		\
+	OP(max17135, int, max17135_get_fault,				\
+	   (struct max17135 *p), (p), 1)				\
+	OP(max17135, int, max17135_get_temp_sensor_en,			\
+	   (struct max17135 *p), (p), 1)				\
+	OP(max17135, int, max17135_get_temperature,			\
+	   (struct max17135 *p, short *t, int id), (p, t, id), 2)	\
+	OP(max17135, float, max17135_convert_temperature,		\
+	   (struct max17135 *p, short t), (p, t), 0)			\
+	OP(max17135, int, max17135_wait_for_pok,			\
+	   (struct max17135 *p), (p), 0)				\
+	OP(tps65185, struct tps65185 *, tps65185_init,			\
+	   (const char *i2c_bus, unsigned i2c_addr),			\
+	   (i2c_bus, i2c_addr), 0)					\
+	VOP(tps65185, tps65185_free,					\
+	    (struct tps65185 *p), (p))					\
+	VOP(tps65185, tps65185_get_info,				\
+	    (struct tps65185 *p, struct tps65185_info *info),		\
+	    (p, info))							\
+	OP(tps65185, int, tps65185_get_vcom,				\
+	   (struct tps65185 *p, uint16_t *vcom), (p, vcom), 2)		\
+	OP(tps65185, int, tps65185_set_vcom,				\
+	   (struct tps65185 *p, uint16_t vcom), (p, vcom), 2)		\
+	OP(tps65185, int, tps65185_get_seq,				\
+	   (struct tps65185 *p, struct tps65185_seq *seq, int up),	\
+	   (p, seq, up), 2)						\
+	OP(tps65185, int, tps65185_set_seq,				\
+	   (struct tps65185 *p, struct tps65185_seq *seq, int up),	\
+	   (p, seq, up), 2)						\
+	OP(tps65185, int, tps65185_set_power,				\
+	   (struct tps65185 *p, int power), (p, power), 1)		\
+	OP(tps65185, int, tps65185_get_en,				\
+	   (struct tps65185 *p, int id), (p, id), 1)			\
+	OP(tps65185, int, tps65185_set_en,				\
+	   (struct tps65185 *p, int id, int on), (p, id, on), 1)	\
+	OP(dac, struct dac5820 *, dac5820_init,				\
+	   (const char *i2c_bus, unsigned i2c_addr),			\
+	   (i2c_bus, i2c_addr), 0)					\
+	VOP(dac, dac5820_free,						\
+	    (struct dac5820 *p), (p))					\
+	OP(dac, int, dac5820_set_power,					\
+	   (struct dac5820 *p, int ch, int power), (p, ch, power), 1)	\
+	OP(dac, int, dac5820_output,					\
+	   (struct dac5820 *p, int ch, int value), (p, ch, value), 1)	\
+	OP(adc, struct adc11607 *, adc11607_init,			\
+	   (const char *i2c_bus, unsigned i2c_addr),			\
+	   (i2c_bus, i2c_addr), 0)					\
+	VOP(adc, adc11607_free,						\
+	    (struct adc11607 *p), (p))					\
+	OP(adc, int, adc11607_get_nb_channels,				\
+	   (struct adc11607 *p), (p), 0)				\
+	OP(adc, int, adc11607_set_ref,					\
+	   (struct adc11607 *p, int ref), (p, ref), 1)			\
+	OP(adc, int, adc11607_read_results,				\
+	   (struct adc11607 *p), (p), 8)				\
+	OP(adc, adc11607_result_t, adc11607_get_result,			\
+	   (struct adc11607 *p, int ch), (p, ch), 0)			\
+	OP(adc, float, adc11607_get_volts,				\
+	   (struct adc11607 *p, adc11607_result_t r), (p, r), 0)	\
+	OP(adc, int, adc11607_get_millivolts,				\
+	   (struct adc11607 *p, adc11607_result_t r), (p, r), 0)	\
+	OP(pbtn, struct pbtn *, pbtn_init,				\
+	   (const char *i2c_bus, unsigned i2c_addr),			\
+	   (i2c_bus, i2c_addr), 0)					\
+	VOP(pbtn, pbtn_free,						\
+	    (struct pbtn *p), (p))					\
+	VOP(pbtn, pbtn_set_abort_cb,					\
+	    (struct pbtn *p, int (*cb) (void)), (p, cb))		\
+	OP(pbtn, int, pbtn_wait,					\
+	   (struct pbtn *p, int btn, int on), (p, btn, on), 0)		\
+	OP(pbtn, int, pbtn_wait_any,					\
+	   (struct pbtn *p, int btns, int on), (p, btns, on), 0)	\
+	OP(pbtn, int, pbtn_read_state,					\
+	   (struct pbtn *p), (p), 1)					\
+	OP(eeprom, struct eeprom *, eeprom_init,			\
+	   (const char *i2c_bus, unsigned i2c_addr, const char *mode),	\
+	   (i2c_bus, i2c_addr, mode), 0)				\
+	VOP(eeprom, eeprom_free,					\
+	    (struct eeprom *p), (p))					\
+	OP(eeprom, size_t, eeprom_get_size,				\
+	   (struct eeprom *p), (p), 0)					\
+	VOP(eeprom, eeprom_set_block_size,				\
+	    (struct eeprom *p, size_t size), (p, size))			\
+	VOP(eeprom, eeprom_set_page_size,				\
+	    (struct eeprom *p, size_t size), (p, size))			\
+	VOP(eeprom, eeprom_seek,					\
+	    (struct eeprom *p, size_t offset), (p, offset))		\
+	OP(eeprom, int, eeprom_read,					\
+	   (struct eeprom *p, char *data, size_t size),			\
+	   (p, data, size), size)					\
+	OP(eeprom, int, eeprom_write,					\
+	   (struct eeprom *p, const char *data, size_t size),		\
+	   (p, data, size), size)
+
+#define HW_OP_MEMBER(dev, ret, name, params, args, bytes) ret (*name) params;
+#define HW_VOP_MEMBER(dev, name, params, args) void (*name) params;
+struct hw_ops {
+	const char *name;
+	HW_OPS(HW_OP_MEMBER, HW_VOP_MEMBER)
+};
+#undef HW_VOP_MEMBER
+#undef HW_OP_MEMBER
+
+#define HW_OP_ID(dev, ret, name, ...) HW_OP_##name,
+#define HW_VOP_ID(dev, name, ...)
+enum hw_op_id {
+	HW_OPS(HW_OP_ID, HW_VOP_ID)
+	HW_OP_N
+};
+#undef HW_VOP_ID
+#undef HW_OP_ID
+
 #define DAC_CH DAC5820_CH_A
 #define DAC_ON DAC5820_POW_ON
 #define DAC_OFF DAC5820_POW_OFF_100K
@@ -84,18 +266,48 @@ static enum { TERM_IN_BLANK, TERM_IN_ERROR, TERM_IN_SAVED, TERM_IN_EDITED }
 static const char *g_i2c_bus = NULL;
 static unsigned g_i2c_addr = PLHW_NO_I2C_ADDR;
 static const char *g_opt = NULL;
+static const char *g_script = NULL;
+static const struct hw_ops hw_plhw;
+static const struct hw_ops hw_sim;
+static const struct hw_ops *g_hw = &hw_plhw;
+static int g_trace = 0;
+static long g_retries = -1;
+static long g_retry_delay_us = -1;
+static int g_progress_fd = -1;
+static int g_serving = 0;
 
 /* Top-level */
 static void print_help(const struct command *commands, const char *help_cmd);
 static int run_cmd(struct ctx *ctx, const struct command *commands,
                    int argc, char **argv);
+static int run_script(struct ctx *ctx, const char *path);
+static int run_cmd_line(struct ctx *ctx, char *line);
 static void sigint_abort(int signum);
 
+/* Server */
+static const char help_serve[];
+static int run_serve(struct ctx *ctx, int argc, char **argv);
+
+/* Hardware backends */
+static int select_hw_backend(const char *i2c_bus);
+static int sim_parse_opt(const char *opt_str);
+static void trace_install(void);
+static void trace_report(void);
+#define RETRY_MAX_RETRIES 100
+static void retry_install(void);
+static void retry_report(void);
+
 /* CPLD */
 static const char help_cpld[];
 static struct cpld *require_cpld(struct ctx *ctx);
 static int run_cpld(struct ctx *ctx, int argc, char **argv);
-static void dump_cpld_data(const struct cpld *cpld);
+static void dump_cpld_data(struct cpld *cpld);
+struct cpld_stage {
+	int mask;
+	int on_mask;
+};
+static int stage_cpld_switch(struct cpld_stage *stage,
+			     const char *assignment);
 
 /* MAX17135 */
 static const char help_max17135[];
@@ -144,8 +356,45 @@ static int run_adc(struct ctx *ctx, int argc, char **argv);
 static const char help_pbtn[];
 static int run_pbtn(struct ctx *ctx, int argc, char **argv);
 static int pbtn_abort_cb(void);
+struct gpio_event {
+	int fd;
+	int owned;
+	int has_value;
+};
+static int open_gpio_event(const char *spec, struct gpio_event *ev);
+static void close_gpio_event(struct gpio_event *ev);
+static int get_gpio_event_value(struct gpio_event *ev);
+static int wait_gpio_event(struct gpio_event *ev, int timeout_ms);
+static int match_pbtn(int state, int btns, int on, int any);
+static int wait_pbtn(struct pbtn *pbtn, struct gpio_event *ev, int btns,
+		     int on, int any);
+static int wait_pok(struct max17135 *max17135, const char *gpio);
 
 /* EEPROM */
+#define EEPROM_BENCH_MAX 16
+#define EEPROM_RANGES_MAX 32
+enum eeprom_write_mode {
+	EEPROM_WRITE_ALL,
+	EEPROM_WRITE_DIFF,
+	EEPROM_WRITE_VERIFY,
+};
+enum eeprom_pattern {
+	EEPROM_PATTERN_RANDOM,
+	EEPROM_PATTERN_WALKING,
+	EEPROM_PATTERN_ADDRESS,
+	EEPROM_PATTERN_CHECKER,
+	EEPROM_PATTERN_BYTE,
+};
+enum eeprom_compress {
+	EEPROM_COMPRESS_AUTO,
+	EEPROM_COMPRESS_NONE,
+	EEPROM_COMPRESS_GZIP,
+	EEPROM_COMPRESS_RLE,
+};
+struct eeprom_range {
+	size_t offset;
+	size_t size;
+};
 struct eeprom_opt {
 	unsigned i2c_addr;
 	size_t data_size;
@@ -153,22 +402,134 @@ struct eeprom_opt {
 	int zero_padding;
 	unsigned long block_size;
 	unsigned long page_size;
+	size_t mode_page_size;
+	size_t buffer_size;
+	unsigned long pipeline;
+	enum eeprom_write_mode write_mode;
+	enum eeprom_compress compress;
+	enum eeprom_pattern pattern;
+	unsigned long seed;
+	char journal[PATH_MAX];
+	int resume;
+	char cache[PATH_MAX - 128];
+	struct eeprom_range ranges[EEPROM_RANGES_MAX];
+	size_t n_ranges;
+	int hexdump;
+	int force;
+	unsigned long bench_blocks[EEPROM_BENCH_MAX];
+	size_t n_bench_blocks;
+	unsigned long bench_pages[EEPROM_BENCH_MAX];
+	size_t n_bench_pages;
+	unsigned long bench_lengths[EEPROM_BENCH_MAX];
+	size_t n_bench_lengths;
 };
 static const char help_eeprom[];
 static int run_eeprom(struct ctx *ctx, int argc, char **argv);
+static int confirm_eeprom_overwrite(void);
 static int full_rw_eeprom(struct eeprom *eeprom, const struct eeprom_opt *opt);
+static int bench_eeprom(struct eeprom *eeprom, const char *mode,
+			const struct eeprom_opt *opt);
+static int probe_eeprom(struct eeprom *eeprom, const struct eeprom_opt *opt);
+static int sum_eeprom(struct eeprom *eeprom, const char *algo_name,
+		      const char *expected, const struct eeprom_opt *opt);
+static int get_disp_data(struct eeprom *eeprom, const char *name,
+			 const struct eeprom_opt *opt);
+static int set_disp_data(struct eeprom *eeprom, const char *name,
+			 const char *value, const struct eeprom_opt *opt);
+static int fill_eeprom(struct eeprom *eeprom, const char *pattern_str,
+		       const struct eeprom_opt *opt);
+struct eeprom_write_stats {
+	size_t pages_written;
+	size_t pages_skipped;
+};
+static int write_eeprom_data(struct eeprom *eeprom, size_t offset,
+			     const char *data, size_t size,
+			     const struct eeprom_opt *opt,
+			     struct eeprom_write_stats *stats);
+static int fill_eeprom_range(struct eeprom *eeprom, size_t offset, size_t size,
+			     enum eeprom_pattern pattern, uint64_t seed,
+			     const struct eeprom_opt *opt,
+			     struct eeprom_write_stats *stats, const char *msg);
 static int pad_eeprom(struct eeprom *eeprom, size_t left,
-		      const struct eeprom_opt *opt);
+		      const struct eeprom_opt *opt,
+		      struct eeprom_write_stats *stats);
 static int rw_file_eeprom(struct eeprom *eeprom, int fd, int write_file,
 			  const struct eeprom_opt *opt);
+static int map_file_eeprom(struct eeprom *eeprom, int fd, int write_file,
+			   const struct eeprom_opt *opt);
+static int ranges_file_eeprom(struct eeprom *eeprom, int fd, int write_file,
+			      size_t esize, const struct eeprom_opt *opt);
+static int parse_eeprom_ranges(const char *str, struct eeprom_opt *eopt);
+static int load_eeprom_layout(const char *path, struct eeprom_opt *eopt);
+static int add_eeprom_range(struct eeprom_opt *eopt, unsigned long offset,
+			    unsigned long size);
+static int save_eeprom_journal(const char *path, const char *image_hash,
+			       const struct eeprom_opt *opt, size_t size,
+			       size_t offset);
+static size_t load_eeprom_journal(struct eeprom *eeprom, const char *path,
+				  const char *image_hash, const char *image,
+				  size_t size, const struct eeprom_opt *opt);
+static int cache_file_eeprom(struct eeprom *eeprom, int fd, int is_reg,
+			     const struct eeprom_opt *opt);
+static int refresh_eeprom_cache(struct eeprom *eeprom, int fd, int is_reg,
+				const struct eeprom_opt *opt);
+static int pipe_file_eeprom(struct eeprom *eeprom, int fd, int write_file,
+			    const struct eeprom_opt *opt);
+static int gang_eeprom(const char *mode, unsigned i2c_addr, int argc,
+		       char **argv, struct eeprom_opt *opt);
 static int parse_eeprom_opt(struct ctx *ctx, struct eeprom_opt *eopt);
+static int parse_eeprom_pattern(const char *str,
+				enum eeprom_pattern *pattern);
 static void log_eeprom_progress(size_t total, size_t rem, const char *msg);
+static size_t get_eeprom_mode_size(const char *mode);
+static size_t get_eeprom_mode_page_size(const char *mode);
+static size_t get_eeprom_page_size(const struct eeprom_opt *opt);
 
 /* Power */
 static const char help_eeprom[];
+#define POWER_STEPS_MAX 32
+#define POWER_VALUE_VCOM -1
+enum power_action {
+	POWER_CPLD_SWITCH,
+	POWER_CPLD_SWITCHES,
+	POWER_MAX17135_WAIT_POK,
+	POWER_DAC_OUTPUT,
+	POWER_DAC_POWER,
+};
+struct power_step {
+	enum power_action action;
+	int id;
+	int value;
+	unsigned long delay_ms;
+	char desc[96];
+};
+struct power_steps {
+	struct power_step on[POWER_STEPS_MAX];
+	size_t n_on;
+	struct power_step off[POWER_STEPS_MAX];
+	size_t n_off;
+};
+struct power_opt {
+	const char *csv;
+	const char *pok_gpio;
+	char *buffer;
+};
 static int run_power(struct ctx *ctx, int argc, char **argv);
-static int power_on_seq0(struct ctx *ctx, char vcom);
-static int power_off_seq0(struct ctx *ctx);
+static int parse_power_opt(struct ctx *ctx, struct power_opt *popt);
+static int load_power_seq(struct ctx *ctx, const char *name,
+			  struct power_steps *steps);
+static int compile_power_seq(const char *name, const char *text,
+			     struct power_steps *steps);
+static int run_power_steps(struct ctx *ctx, const struct power_step *steps,
+			   size_t n_steps, char vcom, const char *pok_gpio,
+			   unsigned long long *durations, size_t *n_done);
+static void report_power_steps(const struct power_step *steps,
+			       const unsigned long long *durations,
+			       size_t n_done, unsigned long long total_us);
+static int save_power_steps(const char *path, const char *name, int on,
+			    const struct power_step *steps,
+			    const unsigned long long *durations,
+			    size_t n_done, size_t n_steps, int stat);
 
 /* ePDC */
 static const char help_epdc[];
@@ -185,21 +546,86 @@ static int save_stdin_termios(void);
 static int restore_stdin_termios(void);
 static int disable_stdin_buffering(void);
 static int get_on_off_opt(const char *on_off);
+static int split_args(char *line, char **argv, int max_args);
+static int parse_ul(const char *str, unsigned long *value);
+static int parse_ul_list(const char *str, unsigned long *values, size_t max);
+static ssize_t read_full(int fd, char *data, size_t size);
+static int write_full(int fd, const char *data, size_t size);
+static unsigned long long get_time_us(void);
+static unsigned long long get_time_ns(void);
+static void sleep_us(unsigned long long us);
+static uint64_t splitmix64(uint64_t x);
+#define HEX_LINE_SIZE 80
+static const char HEX_DIGITS[] = "0123456789ABCDEF";
+static size_t format_hex_line(char *out, size_t offset, const char *data,
+			      size_t size);
 static void dump_hex_data(const char *data, size_t size);
 
+/* Digests */
+#define DIGEST_MAX_SIZE 32
+struct sha256_ctx {
+	uint32_t h[8];
+	uint64_t len;
+	unsigned char buf[64];
+};
+struct xxh64_ctx {
+	uint64_t v[4];
+	uint64_t len;
+	unsigned char buf[32];
+};
+union digest_ctx {
+	uint32_t crc32c;
+	struct sha256_ctx sha256;
+	struct xxh64_ctx xxh64;
+};
+struct digest_algo {
+	const char *name;
+	size_t size;
+	void (*init) (union digest_ctx *ctx);
+	void (*update) (union digest_ctx *ctx, const char *data, size_t size);
+	void (*final) (union digest_ctx *ctx, unsigned char *digest);
+};
+static const struct digest_algo *get_digest_algo(const char *name);
+static void digest_to_str(const unsigned char *digest, size_t size,
+			  char *str);
+
 /* Power sequence configuration */
 
+/* The steps follow the format of the power sequence files, see help_power */
 static const struct power_seq {
 	const char *name;
-	int (*on) (struct ctx *ctx, char vcom);
-	int (*off) (struct ctx *ctx);
+	const char *steps;
 	char timing[MAX17135_NB_TIMINGS];
 } seqs[] = {
-	{ .name = "seq0", .on = power_on_seq0, .off = power_off_seq0,
+	{ .name = "seq0",
+	  .steps =
+	  "on cpld bpcom_clamp on\n"
+	  "on cpld hv on\n"
+	  "on max17135 wait_pok\n"
+	  "on cpld vcom_close off\n"
+	  "on cpld vcom_en on\n"
+	  "on cpld vcom_psu on\n"
+	  "on dac output vcom\n"
+	  "on dac power on\n"
+	  "on cpld vcom_close on\n"
+	  "off cpld vcom_close off\n"
+	  "off cpld vcom_en off\n"
+	  "off dac power off\n"
+	  "off cpld vcom_psu off\n"
+	  "off cpld hv off\n",
 	  .timing = { 8, 2, 11, 3, 0, 0, 0, 0 } },
 	{ .name = NULL },
 };
 
+static const struct switch_id cpld_switches[] = {
+	{ .name = "hv",           .id = CPLD_HVEN },
+	{ .name = "vcom_en",      .id = CPLD_COM_SW_EN },
+	{ .name = "vcom_close",   .id = CPLD_COM_SW_CLOSE },
+	{ .name = "vcom_psu",     .id = CPLD_COM_PSU },
+	{ .name = "bpcom_clamp",  .id = CPLD_BPCOM_CLAMP },
+	{ .name = NULL,           .id = -1 }
+};
+
 static const struct power_seq *get_power_seq(int argc, char **argv);
 
 /* ----------------------------------------------------------------------------
@@ -221,19 +647,22 @@ int main(int argc, char **argv)
 		CMD_STRUCT(eeprom),
 		CMD_STRUCT(power),
 		CMD_STRUCT(epdc),
+		CMD_STRUCT(serve),
 		{ .cmd = NULL, .help = NULL, .run = NULL }
 	};
 
 #undef CMD_STRUCT
 
-	static const char *OPTIONS = "h::va:b:o:";
+	static const char *OPTIONS = "h::va:b:o:f:TP:R:";
 	struct ctx ctx = {
+		.commands = commands,
 		.config = NULL,
 		.cpld = NULL,
 		.max17135 = NULL,
 		.dac = NULL,
 		.adc = NULL,
 		.eeprom = NULL,
+		.eeprom_mode = NULL,
 		.pbtn = NULL,
 	};
 
@@ -277,6 +706,42 @@ int main(int argc, char **argv)
 			g_opt = optarg;
 			break;
 
+		case 'f':
+			g_script = optarg;
+			break;
+
+		case 'T':
+			g_trace = 1;
+			break;
+
+		case 'P': {
+			unsigned long fd;
+
+			if (parse_ul(optarg, &fd) || (fd > INT_MAX)) {
+				LOG("Invalid progress file descriptor");
+				exit(EXIT_FAILURE);
+			}
+
+			g_progress_fd = (int) fd;
+			break;
+		}
+
+		case 'R': {
+			unsigned long values[2];
+			const int n = parse_ul_list(optarg, values, 2);
+
+			if ((n < 1) || (values[0] > RETRY_MAX_RETRIES)) {
+				LOG("Invalid retry options");
+				exit(EXIT_FAILURE);
+			}
+
+			g_retries = values[0];
+
+			if (n > 1)
+				g_retry_delay_us = values[1];
+			break;
+		}
+
 		case '?':
 		default:
 			LOG("Invalid arguments");
@@ -293,11 +758,16 @@ int main(int argc, char **argv)
 
 	/* -- command line arguments -- */
 
-	if (optind == argc) {
+	if ((optind == argc) && (g_script == NULL)) {
 		print_help(commands, NULL);
 		exit(EXIT_SUCCESS);
 	}
 
+	if ((optind != argc) && (g_script != NULL)) {
+		LOG("Invalid arguments, no command with a script file");
+		exit(EXIT_FAILURE);
+	}
+
 	ctx.config = plconfig_init(NULL, "plhwtools");
 
 	if (ctx.config == NULL)
@@ -306,36 +776,72 @@ int main(int argc, char **argv)
 	if (g_i2c_bus == NULL)
 		g_i2c_bus = plconfig_get_str(ctx.config, "i2c-bus", NULL);
 
-	ret = run_cmd(&ctx, commands, (argc - optind), &argv[optind]);
+	if (select_hw_backend(g_i2c_bus) < 0) {
+		plconfig_free(ctx.config);
+		exit(EXIT_FAILURE);
+	}
+
+	if (g_retries < 0)
+		g_retries = plconfig_get_int(ctx.config, "i2c-retries", 0);
+
+	if (g_retry_delay_us < 0)
+		g_retry_delay_us = plconfig_get_int(ctx.config,
+						    "i2c-retry-delay-us", 100);
+
+	if ((g_retries < 0) || (g_retries > RETRY_MAX_RETRIES)
+	    || (g_retry_delay_us < 0)) {
+		LOG("Invalid retry options");
+		plconfig_free(ctx.config);
+		exit(EXIT_FAILURE);
+	}
+
+	if (g_retries > 0)
+		retry_install();
+
+	if (g_trace)
+		trace_install();
+
+	if (g_script != NULL)
+		ret = run_script(&ctx, g_script);
+	else
+		ret = run_cmd(&ctx, commands, (argc - optind), &argv[optind]);
 
 	/* -- clean-up --- */
 
 	if (ctx.cpld != NULL)
-		cpld_free(ctx.cpld);
+		g_hw->cpld_free(ctx.cpld);
 
 	if (ctx.max17135 != NULL)
-		max17135_free(ctx.max17135);
+		g_hw->max17135_free(ctx.max17135);
 
 	if (ctx.tps65185 != NULL)
-		tps65185_free(ctx.tps65185);
+		g_hw->tps65185_free(ctx.tps65185);
 
 	if (ctx.dac != NULL)
-		dac5820_free(ctx.dac);
+		g_hw->dac5820_free(ctx.dac);
 
 	if (ctx.adc != NULL)
-		adc11607_free(ctx.adc);
+		g_hw->adc11607_free(ctx.adc);
 
 	if (ctx.eeprom != NULL)
-		eeprom_free(ctx.eeprom);
+		g_hw->eeprom_free(ctx.eeprom);
+
+	free(ctx.eeprom_mode);
 
 	if (ctx.pbtn != NULL)
-		pbtn_free(ctx.pbtn);
+		g_hw->pbtn_free(ctx.pbtn);
 
 	if (ctx.plep != NULL)
 		plep_free(ctx.plep);
 
 	plconfig_free(ctx.config);
 
+	if (g_retries > 0)
+		retry_report();
+
+	if (g_trace)
+		trace_report();
+
 	if (restore_stdin_termios() < 0)
 		LOG("Warning: failed to restore stdin termios");
 
@@ -359,6 +865,7 @@ static void print_help(const struct command *commands, const char *help_cmd)
 
 	printf(
 "Usage: %s <OPTIONS> <COMMAND_NAME> <COMMAND_ARGUMENTS>\n"
+"       %s <OPTIONS> -f SCRIPT_FILE\n"
 "\n"
 "COMMAND_NAME:\n"
 "    The following commands can be used (arguments are detailed separately):\n"
@@ -370,6 +877,7 @@ static void print_help(const struct command *commands, const char *help_cmd)
 "    pbtn       Push button test procedure using I2C GPIO expander\n"
 "    eeprom     Read/write/test display EEPROM\n"
 "    power      Run full power on/off sequence using multiple devices\n"
+"    serve      Run commands received on a Unix socket with shared devices\n"
 "\n"
 "OPTIONS:\n"
 "  -h [COMMAND]\n"
@@ -381,7 +889,21 @@ static void print_help(const struct command *commands, const char *help_cmd)
 "\n"
 "  -b I2C_BUS_DEVICE\n"
 "    Specify the I2C bus device to be used, typically /dev/i2c-X where X is\n"
-"    the I2C bus number.\n"
+"    the I2C bus number.  Use sim:[OPTIONS] to run all the commands with\n"
+"    simulated devices instead, where OPTIONS is a comma-separated list of:\n"
+"      latency=US     time taken by each I2C transaction (0)\n"
+"      clock=KHZ      I2C clock frequency to add the time for each byte,\n"
+"                     or 0 to ignore the transfer size (0)\n"
+"      twr=US         EEPROM write cycle time after each page write (0)\n"
+"      pok=MS         time between HV enable and POK (2)\n"
+"      max_block=N    largest I2C transfer accepted by the bus, or 0 (0)\n"
+"      page_size=N    actual EEPROM page size, based on the mode by default\n"
+"      nack=N         make every Nth CPLD switch, push button or EEPROM\n"
+"                     transfer fail (0)\n"
+"      eeprom=FILE    load and save the EEPROM contents to FILE\n"
+"      pbtn=S:S:...   push button states returned by successive reads,\n"
+"                     staying on the last one, instead of pressing and\n"
+"                     releasing them as requested\n"
 "\n"
 "  -a I2C_ADDRESS\n"
 "    Specify the I2C address of the device to be used with the command.\n"
@@ -390,7 +912,35 @@ static void print_help(const struct command *commands, const char *help_cmd)
 "  -o COMMAND_OPTIONS\n"
 "    Optional argument string which can be used by the command.  Please see\n"
 "    each command help for more details.\n"
-"\n", APP_NAME);
+"\n"
+"  -T\n"
+"    Measure the time taken by each device function call and print a\n"
+"    summary for each device and function when exiting, with the number of\n"
+"    calls, data bytes and min/p50/p99/max latency in microseconds.  The\n"
+"    p50 and p99 values are approximated to about 6%%.\n"
+"\n"
+"  -R RETRIES[:DELAY_US]\n"
+"    Retry each failed device transfer up to RETRIES times, waiting DELAY_US\n"
+"    microseconds before the first retry and twice as long before each of\n"
+"    the next ones, up to 100ms.  The EEPROM transfers start again from\n"
+"    their initial offset.  The number of retries and failures is printed\n"
+"    for each function when exiting.  The defaults are the i2c-retries and\n"
+"    i2c-retry-delay-us values from plsdk.ini, or no retries and 100us.\n"
+"\n"
+"  -P FD\n"
+"    Also report the progress of long transfers on the file descriptor FD,\n"
+"    as one JSON object per line with the op, done, total, percent,\n"
+"    bytes_per_s, elapsed_s and eta_s values.  The rate and ETA are null\n"
+"    until a second sample is available.\n"
+"\n"
+"  -f SCRIPT_FILE\n"
+"    Run all the commands listed in SCRIPT_FILE, or stdin if SCRIPT_FILE is\n"
+"    `-', within a single process so the devices only get initialised once.\n"
+"    Each line contains a COMMAND_NAME followed by its COMMAND_ARGUMENTS and\n"
+"    may start with `-o COMMAND_OPTIONS' to override the -o option for that\n"
+"    line only.  Empty lines and text following a `#' are ignored.  The\n"
+"    script stops on the first command that fails.\n"
+"\n", APP_NAME, APP_NAME);
 
 	for (cmd = commands; cmd->cmd != NULL; ++cmd)
 		printf("Command: %s\n%s\n", cmd->cmd, cmd->help);
@@ -422,1564 +972,7366 @@ static int run_cmd(struct ctx *ctx, const struct command *commands,
 	return ret;
 }
 
-static void sigint_abort(int signum)
+static int run_script(struct ctx *ctx, const char *path)
 {
-	if (signum == SIGINT) {
-		LOG("abort!");
-		g_abort = 1;
+	FILE *f;
+	char *line = NULL;
+	size_t line_size = 0;
+	unsigned line_no = 0;
+	int ret = 0;
+
+	if (!strcmp(path, "-")) {
+		f = stdin;
+	} else {
+		f = fopen(path, "r");
+
+		if (f == NULL) {
+			LOG("failed to open script file (%s)", path);
+			return -1;
+		}
 	}
-}
 
-/* ----------------------------------------------------------------------------
- * CPLD
- */
+	while (!ret && !g_abort && (getline(&line, &line_size, f) >= 0)) {
+		++line_no;
+		ret = run_cmd_line(ctx, line);
 
-static struct cpld *require_cpld(struct ctx *ctx)
-{
-	if (ctx->cpld == NULL)
-		ctx->cpld = cpld_init(g_i2c_bus, g_i2c_addr);
+		if (ret < 0)
+			LOG("%s:%u: stopping script", path, line_no);
+	}
 
-	return ctx->cpld;
-}
+	free(line);
 
-static int _cpld_set_switch(void *cpld, int sw, int on)
-{
-	return cpld_set_switch(cpld, sw, on);
-}
+	if (f != stdin)
+		fclose(f);
 
-static int _cpld_get_switch(void *cpld, int sw)
-{
-	return cpld_get_switch(cpld, sw);
+	if (g_abort)
+		ret = -1;
+
+	return ret;
 }
 
-static int run_cpld(struct ctx *ctx, int argc, char **argv)
+static int run_cmd_line(struct ctx *ctx, char *line)
 {
-	static const struct switch_id switches[] = {
-		{ .name = "hv",           .id = CPLD_HVEN },
-		{ .name = "vcom_en",      .id = CPLD_COM_SW_EN },
-		{ .name = "vcom_close",   .id = CPLD_COM_SW_CLOSE },
-		{ .name = "vcom_psu",     .id = CPLD_COM_PSU },
-		{ .name = "bpcom_clamp",  .id = CPLD_BPCOM_CLAMP },
-		{ .name = NULL,           .id = -1 }
-	};
+	static const int MAX_ARGS = 32;
+	const char *global_opt = g_opt;
+	char *args[MAX_ARGS];
+	char **cmd_argv = args;
+	int cmd_argc;
+	int ret;
 
-	const char *cmd;
-	const char *arg;
-	struct cpld *cpld = require_cpld(ctx);
+	cmd_argc = split_args(line, args, MAX_ARGS);
 
-	if (cpld == NULL)
+	if (cmd_argc < 0) {
+		LOG("invalid command line");
 		return -1;
-
-	if (argc < 1) {
-		LOG("CPLD v%i, board id: %i", cpld_get_version(cpld),
-		    cpld_get_board_id(cpld));
-
-		LOG_N("initial CPLD data: [");
-		dump_cpld_data(cpld);
-		LOG_PRINT("]\n");
-
-		return 0;
 	}
 
-	cmd = argv[0];
-	arg = (argc > 1) ? argv[1] : NULL;
-
-	if (!strcmp(cmd, "version")) {
-		const int ver = cpld_get_version(cpld);
-
-		if (ver < 0)
-			return -1;
-
-		printf("%i\n", ver);
+	if ((cmd_argc >= 2) && !strcmp(cmd_argv[0], "-o")) {
+		g_opt = cmd_argv[1];
+		cmd_argv += 2;
+		cmd_argc -= 2;
+	}
 
-		return 0;
+	/* A nested server would never return to the script or the server */
+	if (cmd_argc && !strcmp(cmd_argv[0], "serve")) {
+		LOG("serve can only be run from the command line");
+		ret = -1;
+	} else if (cmd_argc) {
+		ret = run_cmd(ctx, ctx->commands, cmd_argc, cmd_argv);
+	} else {
+		ret = 0;
 	}
 
-	return switch_on_off(switches, cpld, cmd, arg, _cpld_get_switch,
-			     _cpld_set_switch);
+	g_opt = global_opt;
+
+	return ret;
 }
 
-static void dump_cpld_data(const struct cpld *cpld)
+static void sigint_abort(int signum)
 {
-	size_t size = cpld_get_data_size(cpld);
-	char *data = malloc(size);
-	const char *end;
-	const char *byte;
-	int n;
-
-	if (data == NULL) {
-		LOG("failed to allocate buffer");
-		return;
+	if (signum == SIGINT) {
+		LOG("abort!");
+		g_abort = 1;
 	}
-
-	n = cpld_dump(cpld, data, size);
-	end = &data[n];
-
-	for (byte = data; byte != end; ++byte)
-		LOG_PRINT("%02X ", *byte);
-
-	LOG_PRINT("\b");
-	free(data);
 }
 
 /* ----------------------------------------------------------------------------
- * HV PMIC
+ * Server
  */
 
-static struct max17135 *require_max17135(struct ctx *ctx)
-{
-	if (ctx->max17135 == NULL)
-		ctx->max17135 = max17135_init(g_i2c_bus, g_i2c_addr);
+#define SERVE_MAX_CLIENTS 16
+#define SERVE_LINE_SIZE 1024
 
-	return ctx->max17135;
-}
+struct serve_client {
+	int fd;
+	size_t len;
+	char line[SERVE_LINE_SIZE];
+};
 
-static int run_max17135(struct ctx *ctx, int argc, char **argv)
+static int serve_request(struct ctx *ctx, int fd, char *line)
 {
-	struct max17135 *max17135 = require_max17135(ctx);
-	const char *cmd_str;
-	int on;
+	static const char *OK_STR = "[ok]\n";
+	static const char *ERROR_STR = "[error]\n";
+	const char *status;
+	int saved_stdin;
+	int saved_stdout;
+	int saved_stderr;
+	int null_fd;
+	int ret;
 
-	if (max17135 == NULL)
-		return -1;
+	fflush(stdout);
+	fflush(stderr);
+	saved_stdin = dup(STDIN_FILENO);
+	saved_stdout = dup(STDOUT_FILENO);
+	saved_stderr = dup(STDERR_FILENO);
+	null_fd = open("/dev/null", O_RDONLY);
 
-	if (argc == 0)
-		return dump_max17135_state(max17135);
+	if ((saved_stdin < 0) || (saved_stdout < 0) || (saved_stderr < 0)
+	    || (null_fd < 0)) {
+		LOG("failed to save standard input and output");
 
-	cmd_str = argv[0];
+		if (saved_stdin >= 0)
+			close(saved_stdin);
 
-	if (!strcmp(cmd_str, "timing"))
-		return set_max17135_timing(max17135, argc - 1, &argv[1]);
+		if (saved_stdout >= 0)
+			close(saved_stdout);
 
-	if (!strcmp(cmd_str, "timings"))
-		return set_max17135_timings(max17135, argc - 1, &argv[1]);
+		if (saved_stderr >= 0)
+			close(saved_stderr);
 
-	if (!strcmp(cmd_str, "vcom"))
-		return set_max17135_vcom(max17135, argc - 1, &argv[1]);
+		if (null_fd >= 0)
+			close(null_fd);
 
-	if (!strcmp(cmd_str, "fault"))
-		return get_max17135_fault(max17135);
+		status = ERROR_STR;
+		goto exit_now;
+	}
 
-	if (argc != 2) {
-		LOG("invalid arguments");
+	/* The requests never read the server input, so the confirmation
+	 * prompts get no answer and fail. */
+	dup2(null_fd, STDIN_FILENO);
+	dup2(fd, STDOUT_FILENO);
+	dup2(fd, STDERR_FILENO);
+	close(null_fd);
+	g_serving = 1;
+
+	ret = run_cmd_line(ctx, line);
+
+	g_serving = 0;
+	fflush(stdout);
+	fflush(stderr);
+	dup2(saved_stdin, STDIN_FILENO);
+	dup2(saved_stdout, STDOUT_FILENO);
+	dup2(saved_stderr, STDERR_FILENO);
+	close(saved_stdin);
+	close(saved_stdout);
+	close(saved_stderr);
+	clearerr(stdin);
+
+	status = (ret < 0) ? ERROR_STR : OK_STR;
+
+exit_now:
+	if (write(fd, status, strlen(status)) < 0)
 		return -1;
-	}
 
-	on = get_on_off_opt(argv[1]);
+	return 0;
+}
 
-	if (on < 0) {
-		LOG("invalid on/off value");
+static int serve_read(struct ctx *ctx, struct serve_client *client)
+{
+	const ssize_t n = read(client->fd, &client->line[client->len],
+			       (SERVE_LINE_SIZE - client->len));
+	char *eol;
+
+	if (n <= 0)
 		return -1;
-	}
 
-	if (!strcmp(cmd_str, "en"))
-		return max17135_set_en(max17135, MAX17135_EN_EN, on);
+	client->len += n;
 
-	if (!strcmp(cmd_str, "cen"))
-		return max17135_set_en(max17135, MAX17135_EN_CEN, on);
+	while ((eol = memchr(client->line, '\n', client->len)) != NULL) {
+		const size_t line_len = eol - client->line + 1;
 
-	if (!strcmp(cmd_str, "cen2"))
-		return max17135_set_en(max17135, MAX17135_EN_CEN2, on);
+		*eol = '\0';
 
-	LOG("invalid arguments");
+		if (serve_request(ctx, client->fd, client->line) < 0)
+			return -1;
 
-	return -1;
+		client->len -= line_len;
+		memmove(client->line, &client->line[line_len], client->len);
+	}
+
+	if (client->len == SERVE_LINE_SIZE) {
+		LOG("request too long, closing connection");
+		return -1;
+	}
+
+	return 0;
 }
 
-static int set_max17135_timing(struct max17135 *p, int argc, char **argv)
+static int run_serve(struct ctx *ctx, int argc, char **argv)
 {
-	int timing_no;
-	int timing_ms;
+	struct serve_client clients[SERVE_MAX_CLIENTS];
+	struct pollfd fds[SERVE_MAX_CLIENTS + 1];
+	struct sockaddr_un addr;
+	__sighandler_t original_sigpipe_handler;
+	const char *path;
+	struct stat st;
+	int n_clients = 0;
+	int sock;
+	int ret = 0;
+	int i;
 
-	if (argc < 2) {
-		LOG("invalid arguments");
+	if (argc > 0)
+		path = argv[0];
+	else
+		path = plconfig_get_str(ctx->config, "serve-socket",
+					"/tmp/plhwtools.sock");
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		LOG("socket path too long: %s", path);
 		return -1;
 	}
 
-	timing_no = atoi(argv[0]);
+	/* Only replace a socket left behind, never any other file */
+	if (!lstat(path, &st)) {
+		if (!S_ISSOCK(st.st_mode)) {
+			LOG("not a socket: %s", path);
+			return -1;
+		}
 
-	if ((timing_no < 0) || (timing_no >= MAX17135_NB_TIMINGS)) {
-		LOG("invalid timing number %i (valid: 0 - %i)",
-		    timing_no, MAX17135_NB_TIMINGS);
+		unlink(path);
+	}
+
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (sock < 0) {
+		LOG("failed to create socket");
 		return -1;
 	}
 
-	timing_ms = atoi(argv[1]);
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
 
-	if ((timing_ms < 0) || (timing_ms > 255)) {
-		LOG("invalid timing value %i (valid: 0 - 255)", timing_ms);
+	if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		LOG("failed to bind socket (%s)", path);
+		close(sock);
 		return -1;
 	}
 
-	LOG("setting timing #%i to %i ms", timing_no, timing_ms);
+	if (listen(sock, SERVE_MAX_CLIENTS) < 0) {
+		LOG("failed to listen on socket");
+		ret = -1;
+		goto exit_close_sock;
+	}
 
-	return max17135_set_timing(p, timing_no, timing_ms);
-}
+	original_sigpipe_handler = signal(SIGPIPE, SIG_IGN);
 
-static int set_max17135_timings(struct max17135 *p, int argc, char **argv)
-{
-	char timings[MAX17135_NB_TIMINGS];
-	int stat;
-	int i;
+	LOG("serving requests on %s, type Ctrl-C to stop", path);
 
-	if (argc < 1) {
-		stat = max17135_get_timings(p, timings, MAX17135_NB_TIMINGS);
+	while (!g_abort) {
+		fds[0].fd = sock;
+		fds[0].events = POLLIN;
 
-		if (stat < 0) {
-			LOG("failed to get the MAX17135 timings");
-			return stat;
+		for (i = 0; i < n_clients; ++i) {
+			fds[i + 1].fd = clients[i].fd;
+			fds[i + 1].events = POLLIN;
 		}
 
-		if (stat != MAX17135_NB_TIMINGS) {
-			LOG("could only read %i timings", stat);
-			return -1;
+		if (poll(fds, (n_clients + 1), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			LOG("poll error");
+			ret = -1;
+			break;
 		}
 
-		for (i = 0; i < MAX17135_NB_TIMINGS; ++i)
-			printf("%d: %d\n", i, timings[i]);
-	} else {
-		const struct power_seq *seq;
-		int n_timings;
+		/* Requests are run one at a time so the bus is never shared */
+		for (i = n_clients - 1; i >= 0; --i) {
+			if (!fds[i + 1].revents)
+				continue;
 
-		if (argc == 1)
-			seq = get_power_seq(argc, argv);
-		else
-			seq = NULL;
+			if (serve_read(ctx, &clients[i]) < 0) {
+				close(clients[i].fd);
+				clients[i] = clients[--n_clients];
+			}
+		}
 
-		if (seq != NULL) {
-			LOG("Setting timings for %s:", seq->name);
+		if (fds[0].revents & POLLIN) {
+			const int fd = accept(sock, NULL, NULL);
 
-			for (i = 0; i < MAX17135_NB_TIMINGS; ++i) {
-				LOG("%d: %d", i, seq->timing[i]);
-				timings[i] = seq->timing[i];
+			if (fd < 0) {
+				LOG("failed to accept connection");
+			} else if (n_clients == SERVE_MAX_CLIENTS) {
+				LOG("too many clients");
+				close(fd);
+			} else {
+				clients[n_clients].fd = fd;
+				clients[n_clients].len = 0;
+				++n_clients;
 			}
+		}
+	}
 
-			n_timings = MAX17135_NB_TIMINGS;
-		} else {
-			if (argc > MAX17135_NB_TIMINGS) {
-				n_timings = MAX17135_NB_TIMINGS;
-				LOG("warning: only using the %d first timings",
-				    n_timings);
-			} else {
-				n_timings = argc;
-			}
+	for (i = 0; i < n_clients; ++i)
+		close(clients[i].fd);
 
-			for (i = 0; i < n_timings; ++i) {
-				int t = atoi(argv[i]);
+	signal(SIGPIPE, original_sigpipe_handler);
 
-				if ((t < 0) || (t > 255)) {
-					LOG("invalid timing %i "
-					    "(valid: 0 - 255)", t);
-					return -1;
-				}
+exit_close_sock:
+	close(sock);
+	unlink(path);
 
-				timings[i] = t;
-			}
-		}
+	return ret;
+}
 
-		stat = max17135_set_timings(p, timings, n_timings);
+#undef SERVE_LINE_SIZE
+#undef SERVE_MAX_CLIENTS
 
-		if (stat) {
-			LOG("failed to write the timings");
-			return stat;
-		}
-	}
+/* ----------------------------------------------------------------------------
+ * Hardware backends
+ */
 
-	return 0;
+static int select_hw_backend(const char *i2c_bus)
+{
+	static const char SIM_PREFIX[] = "sim:";
+
+	if ((i2c_bus == NULL)
+	    || strncmp(i2c_bus, SIM_PREFIX, (sizeof(SIM_PREFIX) - 1)))
+		return 0;
+
+	g_hw = &hw_sim;
+
+	return sim_parse_opt(&i2c_bus[sizeof(SIM_PREFIX) - 1]);
 }
 
-static int set_max17135_vcom(struct max17135 *p, int argc, char **argv)
+/* -- libplhw -- */
+
+/* libplhw has no function to set several switches at once and does not
+ * expose the CPLD registers, so this is only a loop over cpld_set_switch()
+ * with one transfer per switch.  Only the simulated CPLD sets them with a
+ * single transfer. */
+static int cpld_set_switches(struct cpld *p, int mask, int on_mask)
 {
-	int vcom_raw;
+	int sw;
 
-	if (argc < 1) {
-		char value;
+	for (sw = 0; sw < 8; ++sw) {
+		if (!(mask & (1 << sw)))
+			continue;
 
-		if (max17135_get_vcom(p, &value))
+		if (cpld_set_switch(p, sw, ((on_mask & (1 << sw)) ? 1 : 0)))
 			return -1;
-
-		printf("%d\n", value);
-
-		return 0;
 	}
 
-	vcom_raw = atoi(argv[0]);
+	return 0;
+}
 
-	if ((vcom_raw < 0) || (vcom_raw > 255)) {
-		LOG("invalid VCOM value %i (valid: 0 - 255)", vcom_raw);
+/* libplhw has no function to read the buttons once, so wait for any of them
+ * to be pressed with an abort callback which lets it read them only once.
+ * This relies on the callback being called before each read and the abort
+ * is told apart from an I2C error with g_pbtn_read_aborted, but libplhw may
+ * still sleep for its polling period before aborting. */
+static int g_pbtn_read_calls;
+static int g_pbtn_read_aborted;
+
+static int pbtn_read_once_cb(void)
+{
+	if (g_abort || g_pbtn_read_calls++) {
+		g_pbtn_read_aborted = 1;
 		return -1;
 	}
 
-	LOG("setting VCOM to %i (0x%02X)", vcom_raw, vcom_raw);
+	return 0;
+}
+
+static int pbtn_read_state(struct pbtn *p)
+{
+	int state;
 
-	return max17135_set_vcom(p, (char) vcom_raw);
+	g_pbtn_read_calls = 0;
+	g_pbtn_read_aborted = 0;
+	pbtn_set_abort_cb(p, pbtn_read_once_cb);
+	state = pbtn_wait_any(p, PBTN_ALL, 1);
+	pbtn_set_abort_cb(p, NULL);
+
+	if ((state < 0) && g_pbtn_read_aborted && !g_abort)
+		return 0;
+
+	return state;
 }
 
-#define MAX17135_FAULT_CASE(id) \
-	case id: fault_str = #id; break;
+#define HW_PLHW_OP(dev, ret, name, params, args, bytes)		\
+	static ret plhw_##name params { return name args; }
+#define HW_PLHW_VOP(dev, name, params, args)				\
+	static void plhw_##name params { name args; }
+HW_OPS(HW_PLHW_OP, HW_PLHW_VOP)
+#undef HW_PLHW_VOP
+#undef HW_PLHW_OP
+
+#define HW_PLHW_OP_ENTRY(dev, ret, name, ...) .name = plhw_##name,
+#define HW_PLHW_VOP_ENTRY(dev, name, ...) .name = plhw_##name,
+static const struct hw_ops hw_plhw = {
+	.name = "plhw",
+	HW_OPS(HW_PLHW_OP_ENTRY, HW_PLHW_VOP_ENTRY)
+};
+#undef HW_PLHW_VOP_ENTRY
+#undef HW_PLHW_OP_ENTRY
+
+/* -- simulation -- */
+
+/* All the simulated devices share the state of a virtual board, so for
+ * example enabling HV on the CPLD eventually raises POK on the HV PMIC.
+ * Each register access costs the configured transaction latency plus the
+ * time needed to clock the bytes at the configured bus frequency. */
+
+#define SIM_PBTN_STATES_MAX 16
+#define SIM_PBTN_POLL_US 10000
+
+static struct sim_board {
+	unsigned long latency_us;
+	unsigned long clock_khz;
+	unsigned long twr_us;
+	unsigned long pok_ms;
+	unsigned long max_block;
+	unsigned long eeprom_page_size;
+	unsigned long nack;
+	unsigned long n_xfers;
+	const char *eeprom_file;
+	unsigned long pbtn_states[SIM_PBTN_STATES_MAX];
+	int n_pbtn_states;
+	unsigned long long hv_on_us;
+	int vcom_dac;
+} g_sim;
+
+struct sim_cpld {
+	unsigned char data[3];
+};
 
-static int get_max17135_fault(struct max17135 *p)
-{
-	const int fault = max17135_get_fault(p);
-	const char *fault_str = NULL;
+struct sim_max17135 {
+	int en[3];
+	char timings[MAX17135_NB_TIMINGS];
+	char vcom;
+};
 
-	if (fault < 0) {
-		LOG("failed to read MAX17135 fault id");
-		return -1;
-	}
+struct sim_tps65185 {
+	uint16_t vcom;
+	struct tps65185_seq seq[2];
+	int en;
+};
 
-	switch (fault) {
-	MAX17135_FAULT_CASE(MAX17135_FAULT_NONE)
-	MAX17135_FAULT_CASE(MAX17135_FAULT_FBPG)
-	MAX17135_FAULT_CASE(MAX17135_FAULT_HVINP)
-	MAX17135_FAULT_CASE(MAX17135_FAULT_HVINN)
-	MAX17135_FAULT_CASE(MAX17135_FAULT_FBNG)
-	MAX17135_FAULT_CASE(MAX17135_FAULT_HVINPSC)
-	MAX17135_FAULT_CASE(MAX17135_FAULT_HVINNSC)
-	MAX17135_FAULT_CASE(MAX17135_FAULT_OT)
-	}
+struct sim_dac5820 {
+	int power[2];
+	int value[2];
+};
 
-	if (fault_str == NULL) {
-		LOG("invalid MAX17135 fault id");
-		return -1;
-	}
+struct sim_adc11607 {
+	float ref;
+	adc11607_result_t results[4];
+};
 
-	LOG("MAX17135 fault: %s", fault_str);
+struct sim_pbtn {
+	int (*abort_cb) (void);
+	int state;
+	int n_reads;
+};
 
-	return 0;
-}
+struct sim_eeprom {
+	char *data;
+	size_t size;
+	size_t page_size;
+	size_t wr_page_size;
+	size_t block_size;
+	size_t offset;
+};
 
-#undef MAX17135_FAULT_CASE
+enum sim_cpld_reg { SIM_CPLD_VERSION, SIM_CPLD_BOARD_ID, SIM_CPLD_SWITCHES };
 
-static int dump_max17135_state(struct max17135 *p)
+static const unsigned long SIM_POK_POLL_US = 1000;
+static const unsigned long SIM_POK_TIMEOUT_MS = 500;
+
+static int sim_parse_opt(const char *opt_str)
 {
+	const size_t opt_size = strlen(opt_str) + 1;
+	static const char *sep = ",";
+	char *opt_buf;
+	char *opt_it;
+	char *opt;
 	int ret = 0;
 
-	LOG("MAX17135 id: 0x%02X, rev: 0x%02X",
-	    max17135_get_prod_id(p), max17135_get_prod_rev(p));
+	g_sim.latency_us = 0;
+	g_sim.clock_khz = 0;
+	g_sim.twr_us = 0;
+	g_sim.pok_ms = 2;
+	g_sim.max_block = 0;
+	g_sim.eeprom_page_size = 0;
+	g_sim.nack = 0;
+	g_sim.n_xfers = 0;
+	g_sim.eeprom_file = NULL;
+	g_sim.n_pbtn_states = 0;
+	g_sim.hv_on_us = 0;
+	g_sim.vcom_dac = 0;
+
+	opt_buf = opt_it = malloc(opt_size);
+	assert(opt_buf != NULL);
+	memcpy(opt_buf, opt_str, opt_size);
+
+	while ((opt = strsep(&opt_it, sep)) != NULL) {
+		unsigned long *ul_opt = NULL;
+		char *key;
+		char *value;
 
-	if (dump_max17135_en(p, MAX17135_EN_EN) < 0)
-		ret = -1;
+		if (*opt == '\0')
+			continue;
 
-	if (dump_max17135_en(p, MAX17135_EN_CEN) < 0)
-		ret = -1;
+		key = strsep(&opt, "=");
+		value = opt;
 
-	if (dump_max17135_en(p, MAX17135_EN_CEN2) < 0)
-		ret = -1;
+		if (value == NULL) {
+			LOG("no value for simulation option %s", key);
+			ret = -1;
+			break;
+		}
 
-	if (dump_max17135_timings(p) < 0)
-		ret = -1;
+		if (!strcmp(key, "eeprom")) {
+			g_sim.eeprom_file = strdup(value);
+			assert(g_sim.eeprom_file != NULL);
+			continue;
+		}
 
-	if (dump_max17135_vcom(p) < 0)
-		ret = -1;
+		if (!strcmp(key, "pbtn")) {
+			g_sim.n_pbtn_states = parse_ul_list(
+				value, g_sim.pbtn_states, SIM_PBTN_STATES_MAX);
 
-	if (dump_max17135_temperature(p) < 0)
-		ret = -1;
+			if (g_sim.n_pbtn_states < 0) {
+				LOG("invalid value for simulation option %s",
+				    key);
+				ret = -1;
+				break;
+			}
+
+			continue;
+		}
+
+		if (!strcmp(key, "latency"))
+			ul_opt = &g_sim.latency_us;
+		else if (!strcmp(key, "clock"))
+			ul_opt = &g_sim.clock_khz;
+		else if (!strcmp(key, "twr"))
+			ul_opt = &g_sim.twr_us;
+		else if (!strcmp(key, "pok"))
+			ul_opt = &g_sim.pok_ms;
+		else if (!strcmp(key, "max_block"))
+			ul_opt = &g_sim.max_block;
+		else if (!strcmp(key, "page_size"))
+			ul_opt = &g_sim.eeprom_page_size;
+		else if (!strcmp(key, "nack"))
+			ul_opt = &g_sim.nack;
+
+		if (ul_opt == NULL) {
+			LOG("invalid simulation option: %s", key);
+			ret = -1;
+			break;
+		}
+
+		if (parse_ul(value, ul_opt)) {
+			LOG("invalid value for simulation option %s", key);
+			ret = -1;
+			break;
+		}
+	}
+
+	free(opt_buf);
 
 	return ret;
 }
 
-static int dump_max17135_en(struct max17135 *p, enum max17135_en_id id)
+/* Return -1 when the transfer is not acknowledged, which is only checked by
+ * the functions which can fail in the middle of their transfers. */
+static int sim_xfer(size_t n_bytes)
 {
-	const int en = max17135_get_en(p, id);
-	const char *en_name;
+	unsigned long long t_us = g_sim.latency_us;
 
-	switch (id) {
-	case MAX17135_EN_EN:   en_name = "EN";   break;
-	case MAX17135_EN_CEN:  en_name = "CEN";  break;
-	case MAX17135_EN_CEN2: en_name = "CEN2"; break;
-	default:
-		assert(!"invalid power rail identifier");
-		return -1;
-	}
+	if (g_sim.clock_khz)
+		t_us += (n_bytes + 1) * 9 * 1000ULL / g_sim.clock_khz;
 
-	if (en < 0) {
-		LOG("failed to get %s status", en_name);
-		return -1;
-	}
+	if (t_us)
+		sleep_us(t_us);
 
-	LOG("%s status: %s", en_name, en ? "on" : "off");
+	if (g_sim.nack && !(++g_sim.n_xfers % g_sim.nack))
+		return -1;
 
 	return 0;
 }
 
-static int dump_max17135_timings(struct max17135 *p)
+static void sim_set_hv(int on)
 {
-	char timings[MAX17135_NB_TIMINGS];
-	int ret = max17135_get_timings(p, timings, MAX17135_NB_TIMINGS);
+	if (!on)
+		g_sim.hv_on_us = 0;
+	else if (!g_sim.hv_on_us)
+		g_sim.hv_on_us = get_time_us();
+}
 
-	if (ret < 0) {
-		LOG("failed to get the timings");
-	} else {
-		unsigned i;
+static int sim_is_pok(void)
+{
+	return (g_sim.hv_on_us
+		&& ((get_time_us() - g_sim.hv_on_us) >= (g_sim.pok_ms * 1000)));
+}
 
-		for (i = 0; i < MAX17135_NB_TIMINGS; ++i)
-			LOG("timing #%i: %3i ms", i, timings[i]);
-	}
+static struct cpld *sim_cpld_init(const char *i2c_bus, unsigned i2c_addr)
+{
+	struct sim_cpld *p = calloc(1, sizeof(struct sim_cpld));
 
-	return ret;
+	if (p == NULL)
+		return NULL;
+
+	p->data[SIM_CPLD_VERSION] = 5;
+	p->data[SIM_CPLD_BOARD_ID] = 1;
+	sim_xfer(sizeof(p->data));
+
+	return (struct cpld *) p;
 }
 
-static int dump_max17135_vcom(struct max17135 *p)
+static void sim_cpld_free(struct cpld *p)
 {
-	char vcom_raw;
+	free(p);
+}
 
-	if (max17135_get_vcom(p, &vcom_raw) < 0) {
-		LOG("failed to read VCOM");
-		return -1;
-	}
+static int sim_cpld_get_version(struct cpld *p)
+{
+	return ((struct sim_cpld *) p)->data[SIM_CPLD_VERSION];
+}
 
-	LOG("VCOM: %i (0x%02X)", vcom_raw, vcom_raw);
+static int sim_cpld_get_board_id(struct cpld *p)
+{
+	return ((struct sim_cpld *) p)->data[SIM_CPLD_BOARD_ID];
+}
 
-	return 0;
+static size_t sim_cpld_get_data_size(struct cpld *p)
+{
+	return sizeof(((struct sim_cpld *) p)->data);
 }
 
-static int dump_max17135_temperature(struct max17135 *p)
+static int sim_cpld_dump(struct cpld *p, char *data, size_t size)
 {
-	int sensor_en;
-	short temp_i, temp_e;
-	float temp_i_f, temp_e_f;
-	int ret = 0;
+	struct sim_cpld *cpld = (struct sim_cpld *) p;
+	const size_t n = min(size, sizeof(cpld->data));
 
-	sensor_en = max17135_get_temp_sensor_en(p);
+	memcpy(data, cpld->data, n);
 
-	if (sensor_en < 0) {
-		LOG("failed to get the temperature sensor state");
-		ret = -1;
-	} else {
-		LOG("temperature sensor enabled: %s", sensor_en ? "yes":"no");
-	}
+	return n;
+}
 
-	if ((max17135_get_temperature(p, &temp_i, MAX17135_TEMP_INT) < 0)
-	    || (max17135_get_temperature(p, &temp_e, MAX17135_TEMP_EXT) < 0)){
-		LOG("failed to read temperatures");
-		ret = -1;
-	} else {
-		temp_i_f = max17135_convert_temperature(p, temp_i);
-		temp_e_f = max17135_convert_temperature(p, temp_e);
-		LOG("internal temperature: %.1f C", temp_i_f);
-		LOG("external temperature: %.1f C", temp_e_f);
-	}
+static int sim_cpld_set_switch(struct cpld *p, int sw, int on)
+{
+	struct sim_cpld *cpld = (struct sim_cpld *) p;
 
-	return ret;
-}
+	if ((sw < 0) || (sw >= 8))
+		return -1;
 
-/* ----------------------------------------------------------------------------
- * TPS65185
- */
+	if (sim_xfer(sizeof(cpld->data)) < 0)
+		return -1;
 
-static struct tps65185 *require_tps65185(struct ctx *ctx)
-{
-	if (ctx->tps65185 == NULL)
-		ctx->tps65185 = tps65185_init(g_i2c_bus, g_i2c_addr);
+	if (on)
+		cpld->data[SIM_CPLD_SWITCHES] |= (1 << sw);
+	else
+		cpld->data[SIM_CPLD_SWITCHES] &= ~(1 << sw);
 
-	return ctx->tps65185;
+	if (sw == CPLD_HVEN)
+		sim_set_hv(on);
+
+	return 0;
 }
 
-static int run_tps65185(struct ctx *ctx, int argc, char **argv)
+static int sim_cpld_set_switches(struct cpld *p, int mask, int on_mask)
 {
-	struct tps65185 *tps65185 = require_tps65185(ctx);
-	const char *cmd_str;
+	struct sim_cpld *cpld = (struct sim_cpld *) p;
 
-	if (tps65185 == NULL)
+	if (mask & ~0xFF)
 		return -1;
 
-	if (argc == 0)
-		return dump_tps65185_state(tps65185);
+	if (sim_xfer(sizeof(cpld->data)) < 0)
+		return -1;
 
-	cmd_str = argv[0];
+	cpld->data[SIM_CPLD_SWITCHES] &= ~mask;
+	cpld->data[SIM_CPLD_SWITCHES] |= (mask & on_mask);
 
-	if (!strcmp(cmd_str, "vcom"))
-		return run_tps65185_vcom(tps65185, argc - 1, &argv[1]);
+	if (mask & (1 << CPLD_HVEN))
+		sim_set_hv(on_mask & (1 << CPLD_HVEN));
 
-	if (!strcmp(cmd_str, "seq"))
-		return run_tps65185_seq(tps65185, argc - 1, &argv[1]);
+	return 0;
+}
 
-	if (!strcmp(cmd_str, "active"))
-		return tps65185_set_power(tps65185, TPS65185_ACTIVE);
+static int sim_cpld_get_switch(struct cpld *p, int sw)
+{
+	struct sim_cpld *cpld = (struct sim_cpld *) p;
 
-	if (!strcmp(cmd_str, "standby"))
-		return tps65185_set_power(tps65185, TPS65185_STANDBY);
+	if ((sw < 0) || (sw >= 8))
+		return -1;
 
-	if (!strcmp(cmd_str, "en"))
-		return run_tps65185_en(tps65185, argc - 1, &argv[1]);
+	return (cpld->data[SIM_CPLD_SWITCHES] & (1 << sw)) ? 1 : 0;
+}
 
-	LOG("unsupported command: %s", cmd_str);
+static struct max17135 *sim_max17135_init(const char *i2c_bus,
+					  unsigned i2c_addr)
+{
+	struct sim_max17135 *p = calloc(1, sizeof(struct sim_max17135));
 
-	return -1;
+	if (p == NULL)
+		return NULL;
+
+	memcpy(p->timings, MAX17135_TIMINGS_SEQ0, MAX17135_NB_TIMINGS);
+	sim_xfer(2);
+
+	return (struct max17135 *) p;
 }
 
-static int run_tps65185_vcom(struct tps65185 *p, int argc, char **argv)
+static void sim_max17135_free(struct max17135 *p)
 {
-	int vcom_raw;
+	free(p);
+}
 
-	if (argc == 0) {
-		uint16_t vcom;
+static int sim_max17135_get_prod_id(struct max17135 *p)
+{
+	sim_xfer(2);
 
-		if (tps65185_get_vcom(p, &vcom))
-			return -1;
+	return 0x4D;
+}
 
-		printf("%d\n", vcom);
+static int sim_max17135_get_prod_rev(struct max17135 *p)
+{
+	sim_xfer(2);
 
-		return 0;
-	}
+	return 0x01;
+}
 
-	vcom_raw = atoi(argv[0]);
+static int sim_max17135_set_en(struct max17135 *p, int id, int on)
+{
+	struct sim_max17135 *pmic = (struct sim_max17135 *) p;
 
-	if ((vcom_raw < 0) || (vcom_raw > 0x1FF)) {
-		LOG("invalid VCOM value %d (value: 0 - 511)", vcom_raw);
+	if ((id < 0) || (id >= 3))
 		return -1;
-	}
 
-	LOG("setting VCOM to %d (0x%04X)", vcom_raw, vcom_raw);
+	pmic->en[id] = on ? 1 : 0;
+	sim_xfer(2);
+
+	if (id == MAX17135_EN_EN)
+		sim_set_hv(on);
 
-	return tps65185_set_vcom(p, (uint16_t)vcom_raw);
+	return 0;
 }
 
-static int run_tps65185_seq(struct tps65185 *p, int argc, char **argv)
+static int sim_max17135_get_en(struct max17135 *p, int id)
 {
-	struct tps65185_seq seq;
-	const char *up_down_str;
-	int up;
-	int i;
-	char **it;
-
-	if (argc < 1) {
-		LOG("invalid arguments");
+	if ((id < 0) || (id >= 3))
 		return -1;
-	}
 
-	up_down_str = argv[0];
+	sim_xfer(2);
 
-	if (!strcmp(up_down_str, "up")) {
-		up = 1;
-	} else if (!strcmp(up_down_str, "down")) {
-		up = 0;
-	} else {
-		LOG("invalid up/down identifier");
+	return ((struct sim_max17135 *) p)->en[id];
+}
+
+static int sim_max17135_set_timing(struct max17135 *p, int n, int ms)
+{
+	if ((n < 0) || (n >= MAX17135_NB_TIMINGS))
 		return -1;
-	}
 
-	if (argc == 1) {
-		if (tps65185_get_seq(p, &seq, up))
-			return -1;
+	((struct sim_max17135 *) p)->timings[n] = ms;
+	sim_xfer(2);
 
-		dump_tps65185_seq_item("VDDH", seq.vddh, &seq);
-		dump_tps65185_seq_item("VPOS", seq.vpos, &seq);
-		dump_tps65185_seq_item("VEE", seq.vee, &seq);
-		dump_tps65185_seq_item("VNEG", seq.vneg, &seq);
+	return 0;
+}
 
-		return 0;
-	}
+static int sim_max17135_get_timings(struct max17135 *p, char *t, int n)
+{
+	n = min(n, MAX17135_NB_TIMINGS);
+	memcpy(t, ((struct sim_max17135 *) p)->timings, n);
+	sim_xfer(1 + n);
 
-	if (argc != 9) {
-		LOG("invalid sequence arguments");
-		return -1;
-	}
+	return n;
+}
 
-	it = &argv[1];
+static int sim_max17135_set_timings(struct max17135 *p, char *t, int n)
+{
+	n = min(n, MAX17135_NB_TIMINGS);
+	memcpy(((struct sim_max17135 *) p)->timings, t, n);
+	sim_xfer(1 + n);
 
-	{
-		enum tps65185_strobe * const strobes[4] = {
-			&seq.vddh, &seq.vpos, &seq.vee, &seq.vneg
-		};
+	return 0;
+}
 
-		for (i = 0; i < 4; ++i) {
-			const int value = atoi(*it++);
+static int sim_max17135_get_vcom(struct max17135 *p, char *vcom)
+{
+	*vcom = ((struct sim_max17135 *) p)->vcom;
+	sim_xfer(2);
 
-			if ((value < 1) || (value > 4)) {
-				LOG("invalid strobe value: %d (1-4)", value);
-				return -1;
-			}
+	return 0;
+}
 
-			*strobes[i] = value - 1;
-		}
-	}
+static int sim_max17135_set_vcom(struct max17135 *p, char vcom)
+{
+	((struct sim_max17135 *) p)->vcom = vcom;
+	sim_xfer(2);
 
-	{
-		enum tps65185_delay * const delays[4] = {
-			&seq.strobe1, &seq.strobe2, &seq.strobe3, &seq.strobe4
-		};
+	return 0;
+}
 
-		for (i = 0; i < 4; ++i) {
-			const int value = atoi(*it++);
+static int sim_max17135_get_fault(struct max17135 *p)
+{
+	sim_xfer(2);
 
-			if ((value < 3) || (value > 12) || (value % 3)) {
-				LOG("invalid strobe delay value: %d", value);
-				return -1;
-			}
+	return MAX17135_FAULT_NONE;
+}
 
-			*delays[i] = (value / 3) - 1;
-		}
-	}
+static int sim_max17135_get_temp_sensor_en(struct max17135 *p)
+{
+	sim_xfer(2);
 
-	return tps65185_set_seq(p, &seq, up);
+	return 1;
 }
 
-static int run_tps65185_en(struct tps65185 *p, int argc, char **argv)
+/* Temperatures are simulated as signed 8.8 fixed-point values */
+static int sim_max17135_get_temperature(struct max17135 *p, short *t, int id)
 {
-	const char *en_str;
-	enum tps65185_en_id id;
-	int on;
+	*t = (id == MAX17135_TEMP_INT) ? (30 << 8) : (25 << 8);
+	sim_xfer(3);
 
-	if (argc == 0) {
-		LOG("no power rail identifier provided");
-		return -1;
-	}
+	return 0;
+}
 
-	en_str = argv[0];
+static float sim_max17135_convert_temperature(struct max17135 *p, short t)
+{
+	return t / 256.0;
+}
 
-	for (id = 0; id < 6; ++id)
-		if (!strcmp(en_str, tps65185_en_id_str[id]))
-			break;
+static int sim_max17135_wait_for_pok(struct max17135 *p)
+{
+	const unsigned long long timeout_us =
+		get_time_us() + (g_sim.pok_ms + SIM_POK_TIMEOUT_MS) * 1000;
 
-	if (id == 6) {
-		LOG("invalid power rail identifier: %s", en_str);
-		return -1;
-	}
+	for (;;) {
+		sim_xfer(2);
 
-	if (argc == 1) {
-		on = tps65185_get_en(p, id);
+		if (sim_is_pok())
+			return 0;
 
-		if (on < 0)
+		if (g_abort || (get_time_us() > timeout_us))
 			return -1;
 
-		LOG("%s: %s", en_str, on ? "on" : "off");
-
-		return 0;
+		sleep_us(SIM_POK_POLL_US);
 	}
+}
 
-	on = get_on_off_opt(argv[1]);
+static struct tps65185 *sim_tps65185_init(const char *i2c_bus,
+					  unsigned i2c_addr)
+{
+	struct sim_tps65185 *p = calloc(1, sizeof(struct sim_tps65185));
 
-	if (on < 0)
-		return -1;
+	if (p == NULL)
+		return NULL;
 
-	return tps65185_set_en(p, id, on);
+	p->vcom = 0x7D;
+	p->en = 0x20;
+	sim_xfer(2);
+
+	return (struct tps65185 *) p;
 }
 
-static int dump_tps65185_state(struct tps65185 *p)
+static void sim_tps65185_free(struct tps65185 *p)
 {
-	struct tps65185_info info;
-	struct tps65185_seq seq;
-	uint16_t vcom;
-	enum tps65185_en_id en_id;
-
-	tps65185_get_info(p, &info);
-	LOG("version: %d.%d.%d", info.version, info.major, info.minor);
-
-	if (tps65185_get_vcom(p, &vcom)) {
-		LOG("failed to read VCOM...");
-		return -1;
-	}
+	free(p);
+}
 
-	LOG("VCOM: %d (0x%04X)", vcom, vcom);
+static void sim_tps65185_get_info(struct tps65185 *p,
+				  struct tps65185_info *info)
+{
+	sim_xfer(2);
+	memset(info, 0, sizeof(*info));
+	info->version = 6;
+	info->major = 5;
+	info->minor = 1;
+}
 
-	if (tps65185_get_seq(p, &seq, 1))
-		return -1;
+static int sim_tps65185_get_vcom(struct tps65185 *p, uint16_t *vcom)
+{
+	*vcom = ((struct sim_tps65185 *) p)->vcom;
+	sim_xfer(3);
 
-	LOG("Power up sequence:");
-	dump_tps65185_seq_item("VDDH", seq.vddh, &seq);
-	dump_tps65185_seq_item("VPOS", seq.vpos, &seq);
-	dump_tps65185_seq_item("VEE", seq.vee, &seq);
-	dump_tps65185_seq_item("VNEG", seq.vneg, &seq);
+	return 0;
+}
 
-	if (tps65185_get_seq(p, &seq, 0))
-		return -1;
+static int sim_tps65185_set_vcom(struct tps65185 *p, uint16_t vcom)
+{
+	((struct sim_tps65185 *) p)->vcom = vcom & 0x1FF;
+	sim_xfer(3);
 
-	LOG("Power down sequence:");
-	dump_tps65185_seq_item("VDDH", seq.vddh, &seq);
-	dump_tps65185_seq_item("VPOS", seq.vpos, &seq);
-	dump_tps65185_seq_item("VEE", seq.vee, &seq);
-	dump_tps65185_seq_item("VNEG", seq.vneg, &seq);
+	return 0;
+}
 
-	LOG("Power rail states:");
-	for (en_id = 0; en_id < 6; ++en_id) {
-		int en = tps65185_get_en(p, en_id);
+static int sim_tps65185_get_seq(struct tps65185 *p, struct tps65185_seq *seq,
+				int up)
+{
+	*seq = ((struct sim_tps65185 *) p)->seq[up ? 1 : 0];
+	sim_xfer(3);
 
-		if (en < 0)
-			return -1;
+	return 0;
+}
 
-		LOG("%s: %s", tps65185_en_id_str[en_id], en ? "on" : "off");
-	}
+static int sim_tps65185_set_seq(struct tps65185 *p, struct tps65185_seq *seq,
+				int up)
+{
+	((struct sim_tps65185 *) p)->seq[up ? 1 : 0] = *seq;
+	sim_xfer(3);
 
 	return 0;
 }
 
-static void dump_tps65185_seq_item(const char *name,
-				   enum tps65185_strobe strobe,
-				   const struct tps65185_seq *seq)
+static int sim_tps65185_set_power(struct tps65185 *p, int power)
 {
-	enum tps65185_delay delay;
+	sim_xfer(2);
+	sim_set_hv(power == TPS65185_ACTIVE);
 
-	switch (strobe) {
-	case TPS65185_STROBE1:
-		delay = seq->strobe1;
-		break;
-	case TPS65185_STROBE2:
-		delay = seq->strobe2;
-		break;
-	case TPS65185_STROBE3:
-		delay = seq->strobe3;
-		break;
-	case TPS65185_STROBE4:
-		delay = seq->strobe4;
-		break;
-	default:
-		assert(!"invalid strobe identifier");
-		return;
-	}
+	if (power == TPS65185_ACTIVE)
+		while (!sim_is_pok() && !g_abort)
+			sleep_us(SIM_POK_POLL_US);
 
-	LOG("%5s: STROBE%d (%d ms)", name, (strobe + 1), ((delay + 1) * 3));
+	return g_abort ? -1 : 0;
 }
 
-/* ----------------------------------------------------------------------------
- * DAC
- */
-
-static struct dac5820 *require_dac(struct ctx *ctx)
+static int sim_tps65185_get_en(struct tps65185 *p, int id)
 {
-	if (ctx->dac == NULL)
-		ctx->dac = dac5820_init(g_i2c_bus, g_i2c_addr);
+	if ((id < 0) || (id >= 6))
+		return -1;
 
-	return ctx->dac;
+	sim_xfer(2);
+
+	return (((struct sim_tps65185 *) p)->en & (1 << id)) ? 1 : 0;
 }
 
-static int run_dac(struct ctx *ctx, int argc, char **argv)
+static int sim_tps65185_set_en(struct tps65185 *p, int id, int on)
 {
-	struct dac5820 *dac = require_dac(ctx);
-	const char *channel_str;
-	const char *arg_str;
-	enum dac5820_channel_id channel_id;
-	int value;
+	struct sim_tps65185 *pmic = (struct sim_tps65185 *) p;
 
-	if (dac == NULL)
+	if ((id < 0) || (id >= 6))
 		return -1;
 
-	if (argc < 2) {
-		LOG("invalid arguments");
-		return -1;
-	}
+	if (on)
+		pmic->en |= (1 << id);
+	else
+		pmic->en &= ~(1 << id);
 
-	channel_str = argv[0];
-	arg_str = argv[1];
+	sim_xfer(2);
 
-	if (!strcmp(channel_str, "A")) {
-		channel_id = DAC5820_CH_A;
-	} else if (!strcmp(channel_str, "B")) {
-		channel_id = DAC5820_CH_B;
-	}  else {
-		LOG("invalid channel identifier (A or B)");
-		return -1;
-	}
+	return 0;
+}
 
-	if (!strcmp(arg_str, "on"))
-		return dac5820_set_power(dac, channel_id, DAC5820_POW_ON);
+static struct dac5820 *sim_dac5820_init(const char *i2c_bus,
+					unsigned i2c_addr)
+{
+	struct sim_dac5820 *p = calloc(1, sizeof(struct sim_dac5820));
 
-	if (!strcmp(arg_str, "off"))
-		return dac5820_set_power(dac, channel_id,
-					 DAC5820_POW_OFF_FLOAT);
+	if (p == NULL)
+		return NULL;
 
-	if (!strcmp(arg_str, "off1k"))
-		return dac5820_set_power(dac, channel_id,
-					 DAC5820_POW_OFF_1K);
+	p->power[0] = p->power[1] = DAC5820_POW_OFF_FLOAT;
 
-	if (!strcmp(arg_str, "off100k"))
-		return dac5820_set_power(dac, channel_id,
-					 DAC5820_POW_OFF_100K);
+	return (struct dac5820 *) p;
+}
 
-	value = atoi(arg_str);
+static void sim_dac5820_free(struct dac5820 *p)
+{
+	free(p);
+}
 
-	if ((value < 0) || (value > 0xFF)) {
-		LOG("invalid value %i (valid: 0 - 255)", value);
+static int sim_dac5820_set_power(struct dac5820 *p, int ch, int power)
+{
+	struct sim_dac5820 *dac = (struct sim_dac5820 *) p;
+
+	if ((ch < 0) || (ch >= 2))
 		return -1;
-	}
 
-	return dac5820_output(dac, channel_id, value);
+	dac->power[ch] = power;
+	sim_xfer(2);
+
+	if (ch == DAC5820_CH_A)
+		g_sim.vcom_dac = (power == DAC5820_POW_ON) ? dac->value[ch] : 0;
+
+	return 0;
 }
 
-/* ----------------------------------------------------------------------------
- * ADC
- */
+static int sim_dac5820_output(struct dac5820 *p, int ch, int value)
+{
+	struct sim_dac5820 *dac = (struct sim_dac5820 *) p;
 
-static int run_adc(struct ctx *ctx, int argc, char **argv)
+	if ((ch < 0) || (ch >= 2))
+		return -1;
+
+	dac->value[ch] = value & 0xFF;
+	sim_xfer(2);
+
+	if ((ch == DAC5820_CH_A) && (dac->power[ch] == DAC5820_POW_ON))
+		g_sim.vcom_dac = dac->value[ch];
+
+	return 0;
+}
+
+static struct adc11607 *sim_adc11607_init(const char *i2c_bus,
+					  unsigned i2c_addr)
 {
-	struct adc11607 *adc;
-	enum adc11607_ref_id ref;
-	adc11607_result_t result;
-	int nb_chans;
-	int chan;
+	struct sim_adc11607 *p = calloc(1, sizeof(struct sim_adc11607));
+	int i;
 
-	if (ctx->adc == NULL)
-		ctx->adc = adc11607_init(g_i2c_bus, g_i2c_addr);
+	if (p == NULL)
+		return NULL;
 
-	if (ctx->adc == NULL)
-		return -1;
+	p->ref = 2.048;
 
-	adc = ctx->adc;
-	nb_chans = adc11607_get_nb_channels(adc);
+	for (i = 0; i < 4; ++i)
+		p->results[i] = ADC11607_INVALID_RESULT;
 
-	if (argc > 0) {
-		const char *ref_str = argv[0];
+	return (struct adc11607 *) p;
+}
 
-		if (!strcmp(ref_str, "internal")) {
-			ref = ADC11607_REF_INTERNAL;
-		} else if (!strcmp(ref_str, "external")) {
-			/* ToDo: set the external reference voltage value */
-			ref = ADC11607_REF_EXTERNAL;
-		} else if (!strcmp(ref_str, "vdd")) {
-			ref = ADC11607_REF_VDD;
-		} else {
-			LOG("invalid reference voltage");
-			return -1;
-		}
-	} else {
-		ref = ADC11607_REF_INTERNAL;
-	}
+static void sim_adc11607_free(struct adc11607 *p)
+{
+	free(p);
+}
 
-	if (adc11607_set_ref(adc, ref) < 0) {
-		LOG("failed to select reference voltage");
-		return -1;
-	}
+static int sim_adc11607_get_nb_channels(struct adc11607 *p)
+{
+	return 4;
+}
 
-	if (adc11607_read_results(adc) < 0) {
-		LOG("failed to read the ADC results");
+static int sim_adc11607_set_ref(struct adc11607 *p, int ref)
+{
+	struct sim_adc11607 *adc = (struct sim_adc11607 *) p;
+
+	switch (ref) {
+	case ADC11607_REF_INTERNAL: adc->ref = 2.048; break;
+	case ADC11607_REF_EXTERNAL: adc->ref = 2.5;   break;
+	case ADC11607_REF_VDD:      adc->ref = 3.3;   break;
+	default:
 		return -1;
 	}
 
-	if (argc > 1) {
-		static const float VCOM_COEFF = 10.0;
-		const char *chan_arg = argv[1];
-
-		if (!strcmp(chan_arg, "vcom")) {
-			result = adc11607_get_result(adc, 1);
-
-			if (result == ADC11607_INVALID_RESULT) {
-				LOG("invalid result");
-				return -1;
-			}
-
-			printf("%f\n",
-			       adc11607_get_volts(adc, result) * VCOM_COEFF);
+	sim_xfer(1);
 
-			return 0;
-		}
+	return 0;
+}
 
-		chan = atoi(chan_arg);
+/* Channel 1 measures VCOM divided by 10, which follows the DAC output */
+static int sim_adc11607_read_results(struct adc11607 *p)
+{
+	struct sim_adc11607 *adc = (struct sim_adc11607 *) p;
+	const float volts[4] = {
+		1.0, (g_sim.vcom_dac * 0.5 / 255), 0.5, 0.25
+	};
+	int i;
 
-		if ((chan < 0) || (chan >= nb_chans)) {
-			LOG("invalid channel number (0-%i)", (nb_chans - 1));
-			return -1;
-		}
+	for (i = 0; i < 4; ++i) {
+		const float result = volts[i] * 1023 / adc->ref;
 
-		result = adc11607_get_result(adc, chan);
+		adc->results[i] = (result > 1023) ? 1023 : result;
+	}
 
-		if (result == ADC11607_INVALID_RESULT) {
-			LOG("invalid result");
-			return -1;
-		}
+	sim_xfer(8);
 
-		printf("%f\n", adc11607_get_volts(adc, result));
+	return 0;
+}
 
-		return 0;
-	}
+static adc11607_result_t sim_adc11607_get_result(struct adc11607 *p, int ch)
+{
+	if ((ch < 0) || (ch >= 4))
+		return ADC11607_INVALID_RESULT;
 
-	for (chan = 0; chan < nb_chans; ++chan) {
-		result = adc11607_get_result(adc, chan);
+	return ((struct sim_adc11607 *) p)->results[ch];
+}
 
-		if (result == ADC11607_INVALID_RESULT) {
-			LOG("invalid result");
-			return -1;
-		}
+static float sim_adc11607_get_volts(struct adc11607 *p, adc11607_result_t r)
+{
+	return r * ((struct sim_adc11607 *) p)->ref / 1023;
+}
 
-		LOG("ch. %i, result: %i (%.3f V, %i mV)", chan, result,
-		    adc11607_get_volts(adc, result),
-		    adc11607_get_millivolts(adc, result));
-	}
+static int sim_adc11607_get_millivolts(struct adc11607 *p,
+				       adc11607_result_t r)
+{
+	return sim_adc11607_get_volts(p, r) * 1000;
+}
 
-	return 0;
+/* The simulated operator presses and releases the buttons as requested,
+ * unless a sequence of states was given with the pbtn option.  Then the
+ * buttons are polled like libplhw does until they match. */
+static struct pbtn *sim_pbtn_init(const char *i2c_bus, unsigned i2c_addr)
+{
+	return (struct pbtn *) calloc(1, sizeof(struct sim_pbtn));
 }
 
-/* ----------------------------------------------------------------------------
- * GPIO Expanders
- */
+static void sim_pbtn_free(struct pbtn *p)
+{
+	free(p);
+}
 
-static int run_pbtn(struct ctx *ctx, int argc, char **argv)
+static void sim_pbtn_set_abort_cb(struct pbtn *p, int (*cb) (void))
 {
-	struct pbtn *pbtn;
-	int btn;
-	int ret = 0;
+	((struct sim_pbtn *) p)->abort_cb = cb;
+}
 
-	if (ctx->pbtn == NULL)
-		ctx->pbtn = pbtn_init(g_i2c_bus, g_i2c_addr);
+static int sim_pbtn_read_state(struct pbtn *p)
+{
+	struct sim_pbtn *pbtn = (struct sim_pbtn *) p;
 
-	if (ctx->pbtn == NULL)
+	if (sim_xfer(2) < 0)
 		return -1;
 
-	pbtn = ctx->pbtn;
-	pbtn_set_abort_cb(pbtn, pbtn_abort_cb);
+	if (g_sim.n_pbtn_states) {
+		const int i = (pbtn->n_reads < g_sim.n_pbtn_states) ?
+			pbtn->n_reads++ : (g_sim.n_pbtn_states - 1);
 
-	LOG("Type Ctrl-C to abort");
+		pbtn->state = g_sim.pbtn_states[i] & PBTN_ALL;
+	}
 
-	LOG("waiting for button #7 on");
-	btn = pbtn_wait(pbtn, PBTN_7, 1);
-	LOG("result: %i", btn);
+	return pbtn->state;
+}
 
-	if (btn < 0)
-		ret = -1;
+static int sim_pbtn_poll(struct sim_pbtn *pbtn, int btns, int on, int any)
+{
+	for (;;) {
+		int state;
 
-	LOG("waiting for button #7 off");
-	btn = pbtn_wait(pbtn, PBTN_7, 0);
-	LOG("result: %i", btn);
+		if ((pbtn->abort_cb != NULL) && pbtn->abort_cb())
+			return -1;
 
-	if (btn < 0)
-		ret = -1;
+		state = sim_pbtn_read_state((struct pbtn *) pbtn);
 
-	LOG("waiting for button #9 on");
-	btn = pbtn_wait(pbtn, PBTN_9, 1);
-	LOG("result: %i", btn);
+		if ((state < 0) || match_pbtn(state, btns, on, any))
+			return state;
 
-	if (btn < 0)
-		ret = -1;
+		sleep_us(SIM_PBTN_POLL_US);
+	}
+}
 
-	LOG("please release all buttons now");
-	btn = pbtn_wait(pbtn, PBTN_ALL, 0);
-	LOG("thanks");
+static int sim_pbtn_wait(struct pbtn *p, int btn, int on)
+{
+	struct sim_pbtn *pbtn = (struct sim_pbtn *) p;
 
-	if (btn < 0)
-		ret = -1;
+	if (g_sim.n_pbtn_states)
+		return sim_pbtn_poll(pbtn, btn, on, 0);
 
-	LOG("waiting for any button on");
-	btn = pbtn_wait_any(pbtn, PBTN_ALL, 1);
-	LOG("result: 0x%02X", btn);
+	if ((pbtn->abort_cb != NULL) && pbtn->abort_cb())
+		return -1;
 
-	if (btn < 0)
-		ret = -1;
+	if (on)
+		pbtn->state |= btn;
+	else
+		pbtn->state &= ~btn;
 
-	pbtn_set_abort_cb(pbtn, NULL);
+	if (sim_xfer(2) < 0)
+		return -1;
 
-	return ret;
+	return pbtn->state;
 }
 
-static int pbtn_abort_cb(void)
+static int sim_pbtn_wait_any(struct pbtn *p, int btns, int on)
 {
-	return g_abort ? -1 : 0;
-}
+	int state;
 
-/* ----------------------------------------------------------------------------
- * EEPROM
- */
+	if (g_sim.n_pbtn_states)
+		state = sim_pbtn_poll((struct sim_pbtn *) p, btns, on, 1);
+	else
+		state = sim_pbtn_wait(p, (btns & -btns), on);
 
-static int run_eeprom(struct ctx *ctx, int argc, char **argv)
+	return (state < 0) ? state : (state & btns);
+}
+
+static struct eeprom *sim_eeprom_init(const char *i2c_bus, unsigned i2c_addr,
+				      const char *mode)
 {
-	struct eeprom *eeprom;
-	struct eeprom_opt eeprom_opt;
-	const char *eeprom_mode;
-	const char *cmd_str;
-	int fd;
-	unsigned i2c_addr;
-	size_t esize;
-	const char *f_name;
-	int write_file;
-	int ret;
+	const size_t size = get_eeprom_mode_size(mode);
+	struct sim_eeprom *p;
 
-	if (argc < 2) {
-		LOG("invalid arguments");
-		return -1;
+	if (!size) {
+		LOG("invalid EEPROM mode: %s", mode);
+		return NULL;
 	}
 
-	eeprom_mode = argv[0];
-	cmd_str = argv[1];
+	p = malloc(sizeof(struct sim_eeprom));
 
-	i2c_addr = g_i2c_addr;
-	eeprom_opt.i2c_addr = PLHW_NO_I2C_ADDR;
-	eeprom_opt.data_size = 0;
-	eeprom_opt.skip = 0;
-	eeprom_opt.zero_padding = 0;
-	eeprom_opt.block_size = 0;
-	eeprom_opt.page_size = 0;
+	if (p == NULL)
+		return NULL;
 
-	if (g_opt != NULL)
-		if (parse_eeprom_opt(ctx, &eeprom_opt))
-			return -1;
+	p->data = malloc(size);
 
-	if (eeprom_opt.i2c_addr != PLHW_NO_I2C_ADDR)
-		i2c_addr = eeprom_opt.i2c_addr;
-	else
-		i2c_addr = g_i2c_addr;
+	if (p->data == NULL) {
+		free(p);
+		return NULL;
+	}
 
-	if (ctx->eeprom == NULL)
-		ctx->eeprom = eeprom_init(g_i2c_bus, i2c_addr, eeprom_mode);
+	memset(p->data, 0xFF, size);
+	p->size = size;
+	p->page_size = g_sim.eeprom_page_size ?
+		g_sim.eeprom_page_size : get_eeprom_mode_page_size(mode);
+	p->wr_page_size = get_eeprom_mode_page_size(mode);
+	p->block_size = 96;
+	p->offset = 0;
 
-	if (ctx->eeprom == NULL)
-		return -1;
+	if (g_sim.eeprom_file != NULL) {
+		const int fd = open(g_sim.eeprom_file, O_RDONLY);
 
-	eeprom = ctx->eeprom;
+		if (fd >= 0) {
+			if (read(fd, p->data, size) < 0)
+				LOG("failed to read %s", g_sim.eeprom_file);
 
-	esize = eeprom_get_size(eeprom);
+			close(fd);
+		}
+	}
 
-	if (!eeprom_opt.data_size) {
-		eeprom_opt.data_size = esize;
-	} else if (eeprom_opt.data_size > esize) {
-		LOG("data size bigger than EEPROM size");
-		return -1;
+	return (struct eeprom *) p;
+}
+
+static void sim_eeprom_free(struct eeprom *p)
+{
+	struct sim_eeprom *eeprom = (struct sim_eeprom *) p;
+
+	if (g_sim.eeprom_file != NULL) {
+		const int fd = open(g_sim.eeprom_file,
+				    (O_WRONLY | O_CREAT | O_TRUNC), 0644);
+
+		if ((fd < 0) || (write(fd, eeprom->data, eeprom->size) < 0))
+			LOG("failed to save %s", g_sim.eeprom_file);
+
+		if (fd >= 0)
+			close(fd);
 	}
 
-	if (eeprom_opt.block_size)
-		eeprom_set_block_size(eeprom, eeprom_opt.block_size);
+	free(eeprom->data);
+	free(eeprom);
+}
 
-	if (eeprom_opt.page_size)
-		eeprom_set_page_size(eeprom, eeprom_opt.page_size);
+static size_t sim_eeprom_get_size(struct eeprom *p)
+{
+	return ((struct sim_eeprom *) p)->size;
+}
 
-	if (!strcmp(cmd_str, "full_rw")) {
-		char c;
+static void sim_eeprom_set_block_size(struct eeprom *p, size_t size)
+{
+	((struct sim_eeprom *) p)->block_size = size;
+}
+
+static void sim_eeprom_set_page_size(struct eeprom *p, size_t size)
+{
+	((struct sim_eeprom *) p)->wr_page_size = size;
+}
+
+static void sim_eeprom_seek(struct eeprom *p, size_t offset)
+{
+	((struct sim_eeprom *) p)->offset = offset;
+}
 
-		if (disable_stdin_buffering() < 0)
-			LOG("Warning: failed to disable input buffering");
+static int sim_eeprom_read(struct eeprom *p, char *data, size_t size)
+{
+	struct sim_eeprom *eeprom = (struct sim_eeprom *) p;
 
-		LOG_PRINT("Warning: this will overwrite the EEPROM data.\n"
-			  "Continue ? [N/y] ");
-		c = fgetc(stdin);
-		putchar('\n');
+	if ((eeprom->offset + size) > eeprom->size)
+		return -1;
 
-		if (restore_stdin_termios() < 0)
-			LOG("Warning: failed to restore input buffering");
+	while (size) {
+		const size_t n = min(eeprom->block_size, size);
 
-		if (c == 'y') {
-			return full_rw_eeprom(eeprom, &eeprom_opt);
-		} else {
-			LOG_PRINT("aborted\n");
+		if (g_sim.max_block && (n > g_sim.max_block))
 			return -1;
-		}
+
+		if (sim_xfer(2 + n) < 0)
+			return -1;
+
+		memcpy(data, &eeprom->data[eeprom->offset], n);
+		eeprom->offset += n;
+		data += n;
+		size -= n;
 	}
 
-	if (!strcmp(cmd_str, "e2f")) {
-		write_file = 1;
-	} else if (!strcmp(cmd_str, "f2e")) {
-		write_file = 0;
-	} else {
-		LOG("invalid arguments");
+	return 0;
+}
+
+/* Like real parts, data written beyond the end of a page wraps around to the
+ * start of that same page when the configured page size is too large. */
+static int sim_eeprom_write(struct eeprom *p, const char *data, size_t size)
+{
+	struct sim_eeprom *eeprom = (struct sim_eeprom *) p;
+
+	if ((eeprom->offset + size) > eeprom->size)
 		return -1;
-	}
 
-	if (argc < 3) {
-		fd = write_file ? STDOUT_FILENO : STDIN_FILENO;
-		f_name = NULL;
-	} else {
-		static const int write_flags = (O_WRONLY | O_CREAT | O_TRUNC);
-		static const int read_flags = (O_RDONLY);
-		const int flags = write_file ? write_flags : read_flags;
+	while (size) {
+		const size_t wr_page_left = eeprom->wr_page_size
+			- (eeprom->offset % eeprom->wr_page_size);
+		const size_t n = min(min(eeprom->block_size, wr_page_left),
+				     size);
+		const size_t page = eeprom->offset
+			- (eeprom->offset % eeprom->page_size);
+		size_t i;
 
-		f_name = argv[2];
-		fd = open(f_name, flags);
+		if (g_sim.max_block && (n > g_sim.max_block))
+			return -1;
 
-		if (fd < 0) {
-			LOG("failed to open the file (%s)", f_name);
+		if (sim_xfer(2 + n) < 0)
 			return -1;
-		}
-	}
 
-	ret = rw_file_eeprom(eeprom, fd, write_file, &eeprom_opt);
+		for (i = 0; i < n; ++i) {
+			const size_t addr = page + ((eeprom->offset + i)
+						    % eeprom->page_size);
 
-	if (f_name != NULL) {
-		if (write_file) {
-			if (fchmod(fd, 0444) < 0) {
-				LOG("Warning: chmod failed");
-			}
+			eeprom->data[addr] = data[i];
 		}
 
-		close(fd);
+		if (g_sim.twr_us)
+			sleep_us(g_sim.twr_us);
+
+		eeprom->offset += n;
+		data += n;
+		size -= n;
 	}
 
-	return ret;
+	return 0;
 }
 
-static int full_rw_eeprom(struct eeprom *eeprom, const struct eeprom_opt *opt)
-{
-	const size_t dump_size = min(256, opt->data_size);
-	char *data_w = malloc(opt->data_size);
-	char *data_r = malloc(opt->data_size);
-	char *it_r;
-	char *it_w;
-	unsigned i;
-	int ret = 0;
+#define HW_SIM_OP_ENTRY(dev, ret, name, ...) .name = sim_##name,
+#define HW_SIM_VOP_ENTRY(dev, name, ...) .name = sim_##name,
+static const struct hw_ops hw_sim = {
+	.name = "sim",
+	HW_OPS(HW_SIM_OP_ENTRY, HW_SIM_VOP_ENTRY)
+};
+#undef HW_SIM_VOP_ENTRY
+#undef HW_SIM_OP_ENTRY
 
-	if ((data_w == NULL) || (data_r == NULL)) {
-		if (data_r == NULL)
-			LOG("failed to allocate read buffer");
-		else
-			free(data_r);
+/* -- timing instrumentation -- */
 
-		if (data_w == NULL)
-			LOG("failed to allocate write buffer");
-		else
-			free(data_w);
+/* When enabled with -T, all the calls go through this layer which counts
+ * the duration of each call in a log-scale histogram to measure the latency
+ * distribution per function with a fixed amount of memory.  Each power of
+ * two is split in TRACE_HIST_SUB buckets, so the percentiles are within
+ * about 6% of the actual values. */
 
-		return -1;
-	}
+#define TRACE_HIST_SUB_BITS 3
+#define TRACE_HIST_SUB (1 << TRACE_HIST_SUB_BITS)
+#define TRACE_HIST_SIZE ((64 - TRACE_HIST_SUB_BITS + 1) * TRACE_HIST_SUB)
 
-	LOG("preparing buffers ...");
+struct trace_stat {
+	const char *dev;
+	const char *name;
+	unsigned long count;
+	unsigned long long bytes;
+	unsigned long long total_ns;
+	unsigned long long min_ns;
+	unsigned long long max_ns;
+	unsigned long hist[TRACE_HIST_SIZE];
+};
 
-	srand(time(0));
+static struct trace_stat g_trace_stats[HW_OP_N];
+static pthread_mutex_t g_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static const struct hw_ops *g_trace_next;
+static struct hw_ops g_trace_ops;
 
-	for (i = 0, it_w = data_w; i < opt->data_size; ++i)
-		*it_w++ = (rand() & 0xFF);
+/* Small values have one bucket each, then the TRACE_HIST_SUB_BITS bits
+ * after the most significant one give the bucket within its power of two */
+static unsigned trace_hist_index(unsigned long long t)
+{
+	unsigned msb = 0;
 
-	memset(data_r, 0, opt->data_size);
+	if (t < TRACE_HIST_SUB)
+		return t;
 
-	LOG("beginning of the data to be written:");
-	dump_hex_data(data_w, dump_size);
+	while (t >> (msb + 1))
+		++msb;
 
-	LOG("writing to EEPROM ...");
+	return ((msb - TRACE_HIST_SUB_BITS + 1) * TRACE_HIST_SUB)
+		+ ((t >> (msb - TRACE_HIST_SUB_BITS)) & (TRACE_HIST_SUB - 1));
+}
 
-	eeprom_seek(eeprom, 0);
+/* Middle of the range of values counted in a bucket */
+static unsigned long long trace_hist_value(unsigned i)
+{
+	unsigned shift;
 
-	if (eeprom_write(eeprom, data_w, opt->data_size) < 0) {
-		LOG("failed to write data");
-		ret = -1;
-	}
+	if (i < TRACE_HIST_SUB)
+		return i;
 
-	LOG("reading the EEPROM ...");
+	shift = (i / TRACE_HIST_SUB) - 1;
 
-	eeprom_seek(eeprom, 0);
+	return ((unsigned long long) (TRACE_HIST_SUB + (i % TRACE_HIST_SUB))
+		<< shift) + ((1ULL << shift) / 2);
+}
 
-	if (eeprom_read(eeprom, data_r, opt->data_size) < 0) {
-		LOG("failed to read data");
-		ret = -1;
-	}
+static unsigned long long trace_percentile(const struct trace_stat *stat,
+					   unsigned percent)
+{
+	const unsigned long rank = (stat->count - 1) * percent / 100;
+	unsigned long n = 0;
+	unsigned i;
 
-	LOG("beginning of the data read back:");
-	dump_hex_data(data_r, dump_size);
+	for (i = 0; i < TRACE_HIST_SIZE; ++i) {
+		n += stat->hist[i];
 
-	LOG("comparing results ...");
+		if (n > rank)
+			break;
+	}
 
-	for (i = 0, it_r = data_r, it_w = data_w; i < opt->data_size; ++i) {
-		if (*it_r++ != *it_w++) {
-			const int addr = (i > 128) ? (i - 128) : 0;
+	return min(max(trace_hist_value(i), stat->min_ns), stat->max_ns);
+}
 
-			LOG("error found at address 0x%04X", i);
-			LOG("dump start at 0x%04X", addr);
-			LOG("written:");
-			dump_hex_data(&data_w[addr], dump_size);
-			LOG("read:");
-			dump_hex_data(&data_r[addr], dump_size);
+static void trace_record(enum hw_op_id id, const char *dev, const char *name,
+			 size_t bytes, unsigned long long t0)
+{
+	const unsigned long long t = get_time_ns() - t0;
+	struct trace_stat *stat = &g_trace_stats[id];
+
+	pthread_mutex_lock(&g_trace_lock);
+	stat->dev = dev;
+	stat->name = name;
+	stat->count++;
+	stat->bytes += bytes;
+	stat->total_ns += t;
+
+	if ((stat->count == 1) || (t < stat->min_ns))
+		stat->min_ns = t;
+
+	if (t > stat->max_ns)
+		stat->max_ns = t;
+
+	stat->hist[trace_hist_index(t)]++;
+	pthread_mutex_unlock(&g_trace_lock);
+}
+
+#define HW_TRACE_OP(dev, ret, name, params, args, bytes)		\
+	static ret trace_##name params					\
+	{								\
+		const unsigned long long t0 = get_time_ns();		\
+		ret res = g_trace_next->name args;			\
+		trace_record(HW_OP_##name, #dev, #name, (bytes), t0);	\
+		return res;						\
+	}
+#define HW_TRACE_VOP(dev, name, params, args)
+HW_OPS(HW_TRACE_OP, HW_TRACE_VOP)
+#undef HW_TRACE_VOP
+#undef HW_TRACE_OP
+
+static void trace_install(void)
+{
+	g_trace_next = g_hw;
+	g_trace_ops = *g_hw;
+	g_trace_ops.name = "trace";
+
+#define HW_TRACE_OP_ENTRY(dev, ret, name, ...)				\
+	g_trace_ops.name = trace_##name;
+#define HW_TRACE_VOP_ENTRY(dev, name, ...)
+	HW_OPS(HW_TRACE_OP_ENTRY, HW_TRACE_VOP_ENTRY)
+#undef HW_TRACE_VOP_ENTRY
+#undef HW_TRACE_OP_ENTRY
+
+	g_hw = &g_trace_ops;
+}
+
+static void trace_report(void)
+{
+	static const char *US_FMT = " %9.1f";
+	int id;
+
+	LOG_PRINT("%-9s %-28s %7s %9s %9s %9s %9s %9s %11s\n",
+		  "device", "function", "count", "bytes", "min_us", "p50_us",
+		  "p99_us", "max_us", "total_ms");
+
+	for (id = 0; id < HW_OP_N; ++id) {
+		const struct trace_stat *stat = &g_trace_stats[id];
+
+		if (!stat->count)
+			continue;
+
+		LOG_PRINT("%-9s %-28s %7lu %9llu", stat->dev, stat->name,
+			  stat->count, stat->bytes);
+		LOG_PRINT(US_FMT, stat->min_ns / 1000.0);
+		LOG_PRINT(US_FMT, trace_percentile(stat, 50) / 1000.0);
+		LOG_PRINT(US_FMT, trace_percentile(stat, 99) / 1000.0);
+		LOG_PRINT(US_FMT, stat->max_ns / 1000.0);
+		LOG_PRINT(" %11.3f\n", stat->total_ns / 1000000.0);
+	}
+}
+
+/* -- retries -- */
+
+/* When enabled with -R, the calls which transfer data are retried with an
+ * exponential backoff when they fail.  The EEPROM offset is not known once
+ * a transfer has failed, so the last one set by the thread is kept to seek
+ * again before each retry. */
+
+#define RETRY_MAX_DELAY_US 100000
+
+struct retry_stat {
+	const char *dev;
+	const char *name;
+	unsigned long retried;
+	unsigned long recovered;
+	unsigned long failed;
+};
+
+static struct retry_stat g_retry_stats[HW_OP_N];
+static pthread_mutex_t g_retry_lock = PTHREAD_MUTEX_INITIALIZER;
+static const struct hw_ops *g_retry_next;
+static struct hw_ops g_retry_ops;
+static __thread struct {
+	const void *eeprom;
+	size_t offset;
+} g_retry_pos;
+
+static int retry_is_eeprom_xfer(enum hw_op_id id)
+{
+	return (id == HW_OP_eeprom_read) || (id == HW_OP_eeprom_write);
+}
+
+/* Return 1 when the call can be made again after waiting, with the delay
+ * doubled each time up to RETRY_MAX_DELAY_US */
+static int retry_wait(enum hw_op_id id, const char *dev, const char *name,
+		      const void *p, unsigned attempt,
+		      unsigned long *delay_us)
+{
+	struct retry_stat *stat = &g_retry_stats[id];
+	const int again = (attempt < g_retries) && !g_abort
+		&& (!retry_is_eeprom_xfer(id) || (g_retry_pos.eeprom == p));
+
+	pthread_mutex_lock(&g_retry_lock);
+	stat->dev = dev;
+	stat->name = name;
+
+	if (again)
+		stat->retried++;
+	else
+		stat->failed++;
+
+	pthread_mutex_unlock(&g_retry_lock);
+
+	if (!again)
+		return 0;
+
+	sleep_us(*delay_us);
+	*delay_us = min((*delay_us * 2), RETRY_MAX_DELAY_US);
+
+	if (retry_is_eeprom_xfer(id))
+		g_retry_next->eeprom_seek((struct eeprom *) p,
+					  g_retry_pos.offset);
+
+	return 1;
+}
+
+static void retry_done(enum hw_op_id id, const void *p, size_t bytes,
+		       unsigned attempt)
+{
+	if (attempt) {
+		pthread_mutex_lock(&g_retry_lock);
+		g_retry_stats[id].recovered++;
+		pthread_mutex_unlock(&g_retry_lock);
+	}
+
+	if (retry_is_eeprom_xfer(id) && (g_retry_pos.eeprom == p))
+		g_retry_pos.offset += bytes;
+}
+
+/* Only the calls which transfer some data are retried, and they all return
+ * a negative value on error. */
+#define HW_RETRY_FIRST(...) HW_RETRY_FIRST_(__VA_ARGS__, 0)
+#define HW_RETRY_FIRST_(first, ...) first
+#define HW_RETRY_OP(dev, ret, name, params, args, bytes)		\
+	static ret retry_##name params					\
+	{								\
+		const void *dev_ = HW_RETRY_FIRST args;			\
+		unsigned long delay_us =				\
+			min(g_retry_delay_us, RETRY_MAX_DELAY_US);	\
+		unsigned attempt = 0;					\
+		ret res;						\
+									\
+		while (((res = g_retry_next->name args), (bytes))	\
+		       && ((intptr_t) res < 0)) {			\
+			if (!retry_wait(HW_OP_##name, #dev, #name,	\
+					dev_, attempt++, &delay_us))	\
+				return res;				\
+		}							\
+									\
+		retry_done(HW_OP_##name, dev_, (bytes), attempt);	\
+		return res;						\
+	}
+#define HW_RETRY_VOP(dev, name, params, args)
+HW_OPS(HW_RETRY_OP, HW_RETRY_VOP)
+#undef HW_RETRY_VOP
+#undef HW_RETRY_OP
+
+static void retry_eeprom_seek(struct eeprom *p, size_t offset)
+{
+	g_retry_pos.eeprom = p;
+	g_retry_pos.offset = offset;
+	g_retry_next->eeprom_seek(p, offset);
+}
+
+static void retry_install(void)
+{
+	g_retry_next = g_hw;
+	g_retry_ops = *g_hw;
+	g_retry_ops.name = "retry";
+
+#define HW_RETRY_OP_ENTRY(dev, ret, name, ...)				\
+	g_retry_ops.name = retry_##name;
+#define HW_RETRY_VOP_ENTRY(dev, name, ...)
+	HW_OPS(HW_RETRY_OP_ENTRY, HW_RETRY_VOP_ENTRY)
+#undef HW_RETRY_VOP_ENTRY
+#undef HW_RETRY_OP_ENTRY
+
+	g_retry_ops.eeprom_seek = retry_eeprom_seek;
+	g_hw = &g_retry_ops;
+}
+
+static void retry_report(void)
+{
+	int header = 0;
+	int id;
+
+	for (id = 0; id < HW_OP_N; ++id) {
+		const struct retry_stat *stat = &g_retry_stats[id];
+
+		if (!stat->retried && !stat->failed)
+			continue;
+
+		if (!header) {
+			LOG_PRINT("%-9s %-28s %9s %9s %9s\n", "device",
+				  "function", "retried", "recovered",
+				  "failed");
+			header = 1;
+		}
+
+		LOG_PRINT("%-9s %-28s %9lu %9lu %9lu\n", stat->dev,
+			  stat->name, stat->retried, stat->recovered,
+			  stat->failed);
+	}
+}
+
+/* ----------------------------------------------------------------------------
+ * CPLD
+ */
+
+static struct cpld *require_cpld(struct ctx *ctx)
+{
+	if (ctx->cpld == NULL)
+		ctx->cpld = g_hw->cpld_init(g_i2c_bus, g_i2c_addr);
+
+	return ctx->cpld;
+}
+
+static int _cpld_set_switch(void *cpld, int sw, int on)
+{
+	return g_hw->cpld_set_switch(cpld, sw, on);
+}
+
+static int _cpld_get_switch(void *cpld, int sw)
+{
+	return g_hw->cpld_get_switch(cpld, sw);
+}
+
+static int run_cpld(struct ctx *ctx, int argc, char **argv)
+{
+	const char *cmd;
+	const char *arg;
+	struct cpld *cpld = require_cpld(ctx);
+
+	if (cpld == NULL)
+		return -1;
+
+	if (argc < 1) {
+		LOG("CPLD v%i, board id: %i", g_hw->cpld_get_version(cpld),
+		    g_hw->cpld_get_board_id(cpld));
+
+		LOG_N("initial CPLD data: [");
+		dump_cpld_data(cpld);
+		LOG_PRINT("]\n");
+
+		return 0;
+	}
+
+	cmd = argv[0];
+	arg = (argc > 1) ? argv[1] : NULL;
+
+	if (!strcmp(cmd, "set")) {
+		struct cpld_stage stage = { 0, 0 };
+		int i;
+
+		for (i = 1; i < argc; ++i) {
+			if (stage_cpld_switch(&stage, argv[i])) {
+				LOG("invalid switch setting: %s", argv[i]);
+				return -1;
+			}
+		}
+
+		if (!stage.mask) {
+			LOG("invalid arguments");
+			return -1;
+		}
+
+		return g_hw->cpld_set_switches(cpld, stage.mask,
+					       stage.on_mask);
+	}
+
+	if (!strcmp(cmd, "version")) {
+		const int ver = g_hw->cpld_get_version(cpld);
+
+		if (ver < 0)
+			return -1;
+
+		printf("%i\n", ver);
+
+		return 0;
+	}
+
+	return switch_on_off(cpld_switches, cpld, cmd, arg, _cpld_get_switch,
+			     _cpld_set_switch);
+}
+
+/* Add a SWITCH=on|off setting to the stage, the last one of each switch is
+ * used when they are all set together. */
+static int stage_cpld_switch(struct cpld_stage *stage,
+			     const char *assignment)
+{
+	const char *value = strchr(assignment, '=');
+	const struct switch_id *sw;
+	int on;
+
+	if (value == NULL)
+		return -1;
+
+	for (sw = cpld_switches; sw->name != NULL; ++sw)
+		if ((strlen(sw->name) == (size_t) (value - assignment))
+		    && !strncmp(sw->name, assignment, (value - assignment)))
+			break;
+
+	on = get_on_off_opt(&value[1]);
+
+	if ((sw->name == NULL) || (on < 0))
+		return -1;
+
+	stage->mask |= (1 << sw->id);
+
+	if (on)
+		stage->on_mask |= (1 << sw->id);
+	else
+		stage->on_mask &= ~(1 << sw->id);
+
+	return 0;
+}
+
+static void dump_cpld_data(struct cpld *cpld)
+{
+	size_t size = g_hw->cpld_get_data_size(cpld);
+	char *data = malloc(size);
+	char *text;
+	char *it;
+	int n;
+	int i;
+
+	if (data == NULL) {
+		LOG("failed to allocate buffer");
+		return;
+	}
+
+	n = g_hw->cpld_dump(cpld, data, size);
+	text = malloc((n > 0) ? (n * 3) : 1);
+
+	if (text == NULL) {
+		LOG("failed to allocate buffer");
+		free(data);
+		return;
+	}
+
+	for (i = 0, it = text; i < n; ++i) {
+		const unsigned char byte = data[i];
+
+		if (i)
+			*it++ = ' ';
+
+		*it++ = HEX_DIGITS[byte >> 4];
+		*it++ = HEX_DIGITS[byte & 0xF];
+	}
+
+	*it = '\0';
+	LOG_PRINT("%s", text);
+	free(text);
+	free(data);
+}
+
+/* ----------------------------------------------------------------------------
+ * HV PMIC
+ */
+
+static struct max17135 *require_max17135(struct ctx *ctx)
+{
+	if (ctx->max17135 == NULL)
+		ctx->max17135 = g_hw->max17135_init(g_i2c_bus, g_i2c_addr);
+
+	return ctx->max17135;
+}
+
+static int run_max17135(struct ctx *ctx, int argc, char **argv)
+{
+	struct max17135 *max17135 = require_max17135(ctx);
+	const char *cmd_str;
+	int on;
+
+	if (max17135 == NULL)
+		return -1;
+
+	if (argc == 0)
+		return dump_max17135_state(max17135);
+
+	cmd_str = argv[0];
+
+	if (!strcmp(cmd_str, "timing"))
+		return set_max17135_timing(max17135, argc - 1, &argv[1]);
+
+	if (!strcmp(cmd_str, "timings"))
+		return set_max17135_timings(max17135, argc - 1, &argv[1]);
+
+	if (!strcmp(cmd_str, "vcom"))
+		return set_max17135_vcom(max17135, argc - 1, &argv[1]);
+
+	if (!strcmp(cmd_str, "fault"))
+		return get_max17135_fault(max17135);
+
+	if (argc != 2) {
+		LOG("invalid arguments");
+		return -1;
+	}
+
+	on = get_on_off_opt(argv[1]);
+
+	if (on < 0) {
+		LOG("invalid on/off value");
+		return -1;
+	}
+
+	if (!strcmp(cmd_str, "en"))
+		return g_hw->max17135_set_en(max17135, MAX17135_EN_EN, on);
+
+	if (!strcmp(cmd_str, "cen"))
+		return g_hw->max17135_set_en(max17135, MAX17135_EN_CEN, on);
+
+	if (!strcmp(cmd_str, "cen2"))
+		return g_hw->max17135_set_en(max17135, MAX17135_EN_CEN2, on);
+
+	LOG("invalid arguments");
+
+	return -1;
+}
+
+static int set_max17135_timing(struct max17135 *p, int argc, char **argv)
+{
+	int timing_no;
+	int timing_ms;
+
+	if (argc < 2) {
+		LOG("invalid arguments");
+		return -1;
+	}
+
+	timing_no = atoi(argv[0]);
+
+	if ((timing_no < 0) || (timing_no >= MAX17135_NB_TIMINGS)) {
+		LOG("invalid timing number %i (valid: 0 - %i)",
+		    timing_no, MAX17135_NB_TIMINGS);
+		return -1;
+	}
+
+	timing_ms = atoi(argv[1]);
+
+	if ((timing_ms < 0) || (timing_ms > 255)) {
+		LOG("invalid timing value %i (valid: 0 - 255)", timing_ms);
+		return -1;
+	}
+
+	LOG("setting timing #%i to %i ms", timing_no, timing_ms);
+
+	return g_hw->max17135_set_timing(p, timing_no, timing_ms);
+}
+
+static int set_max17135_timings(struct max17135 *p, int argc, char **argv)
+{
+	char timings[MAX17135_NB_TIMINGS];
+	int stat;
+	int i;
+
+	if (argc < 1) {
+		stat = g_hw->max17135_get_timings(p, timings,
+						  MAX17135_NB_TIMINGS);
+
+		if (stat < 0) {
+			LOG("failed to get the MAX17135 timings");
+			return stat;
+		}
+
+		if (stat != MAX17135_NB_TIMINGS) {
+			LOG("could only read %i timings", stat);
+			return -1;
+		}
+
+		for (i = 0; i < MAX17135_NB_TIMINGS; ++i)
+			printf("%d: %d\n", i, timings[i]);
+	} else {
+		const struct power_seq *seq;
+		int n_timings;
+
+		if (argc == 1)
+			seq = get_power_seq(argc, argv);
+		else
+			seq = NULL;
+
+		if (seq != NULL) {
+			LOG("Setting timings for %s:", seq->name);
+
+			for (i = 0; i < MAX17135_NB_TIMINGS; ++i) {
+				LOG("%d: %d", i, seq->timing[i]);
+				timings[i] = seq->timing[i];
+			}
+
+			n_timings = MAX17135_NB_TIMINGS;
+		} else {
+			if (argc > MAX17135_NB_TIMINGS) {
+				n_timings = MAX17135_NB_TIMINGS;
+				LOG("warning: only using the %d first timings",
+				    n_timings);
+			} else {
+				n_timings = argc;
+			}
+
+			for (i = 0; i < n_timings; ++i) {
+				int t = atoi(argv[i]);
+
+				if ((t < 0) || (t > 255)) {
+					LOG("invalid timing %i "
+					    "(valid: 0 - 255)", t);
+					return -1;
+				}
+
+				timings[i] = t;
+			}
+		}
+
+		stat = g_hw->max17135_set_timings(p, timings, n_timings);
+
+		if (stat) {
+			LOG("failed to write the timings");
+			return stat;
+		}
+	}
+
+	return 0;
+}
+
+static int set_max17135_vcom(struct max17135 *p, int argc, char **argv)
+{
+	int vcom_raw;
+
+	if (argc < 1) {
+		char value;
+
+		if (g_hw->max17135_get_vcom(p, &value))
+			return -1;
+
+		printf("%d\n", value);
+
+		return 0;
+	}
+
+	vcom_raw = atoi(argv[0]);
+
+	if ((vcom_raw < 0) || (vcom_raw > 255)) {
+		LOG("invalid VCOM value %i (valid: 0 - 255)", vcom_raw);
+		return -1;
+	}
+
+	LOG("setting VCOM to %i (0x%02X)", vcom_raw, vcom_raw);
+
+	return g_hw->max17135_set_vcom(p, (char) vcom_raw);
+}
+
+#define MAX17135_FAULT_CASE(id) \
+	case id: fault_str = #id; break;
+
+static int get_max17135_fault(struct max17135 *p)
+{
+	const int fault = g_hw->max17135_get_fault(p);
+	const char *fault_str = NULL;
+
+	if (fault < 0) {
+		LOG("failed to read MAX17135 fault id");
+		return -1;
+	}
+
+	switch (fault) {
+	MAX17135_FAULT_CASE(MAX17135_FAULT_NONE)
+	MAX17135_FAULT_CASE(MAX17135_FAULT_FBPG)
+	MAX17135_FAULT_CASE(MAX17135_FAULT_HVINP)
+	MAX17135_FAULT_CASE(MAX17135_FAULT_HVINN)
+	MAX17135_FAULT_CASE(MAX17135_FAULT_FBNG)
+	MAX17135_FAULT_CASE(MAX17135_FAULT_HVINPSC)
+	MAX17135_FAULT_CASE(MAX17135_FAULT_HVINNSC)
+	MAX17135_FAULT_CASE(MAX17135_FAULT_OT)
+	}
+
+	if (fault_str == NULL) {
+		LOG("invalid MAX17135 fault id");
+		return -1;
+	}
+
+	LOG("MAX17135 fault: %s", fault_str);
+
+	return 0;
+}
+
+#undef MAX17135_FAULT_CASE
+
+static int dump_max17135_state(struct max17135 *p)
+{
+	int ret = 0;
+
+	LOG("MAX17135 id: 0x%02X, rev: 0x%02X",
+	    g_hw->max17135_get_prod_id(p), g_hw->max17135_get_prod_rev(p));
+
+	if (dump_max17135_en(p, MAX17135_EN_EN) < 0)
+		ret = -1;
+
+	if (dump_max17135_en(p, MAX17135_EN_CEN) < 0)
+		ret = -1;
+
+	if (dump_max17135_en(p, MAX17135_EN_CEN2) < 0)
+		ret = -1;
+
+	if (dump_max17135_timings(p) < 0)
+		ret = -1;
+
+	if (dump_max17135_vcom(p) < 0)
+		ret = -1;
+
+	if (dump_max17135_temperature(p) < 0)
+		ret = -1;
+
+	return ret;
+}
+
+static int dump_max17135_en(struct max17135 *p, enum max17135_en_id id)
+{
+	const int en = g_hw->max17135_get_en(p, id);
+	const char *en_name;
+
+	switch (id) {
+	case MAX17135_EN_EN:   en_name = "EN";   break;
+	case MAX17135_EN_CEN:  en_name = "CEN";  break;
+	case MAX17135_EN_CEN2: en_name = "CEN2"; break;
+	default:
+		assert(!"invalid power rail identifier");
+		return -1;
+	}
+
+	if (en < 0) {
+		LOG("failed to get %s status", en_name);
+		return -1;
+	}
+
+	LOG("%s status: %s", en_name, en ? "on" : "off");
+
+	return 0;
+}
+
+static int dump_max17135_timings(struct max17135 *p)
+{
+	char timings[MAX17135_NB_TIMINGS];
+	int ret = g_hw->max17135_get_timings(p, timings, MAX17135_NB_TIMINGS);
+
+	if (ret < 0) {
+		LOG("failed to get the timings");
+	} else {
+		unsigned i;
+
+		for (i = 0; i < MAX17135_NB_TIMINGS; ++i)
+			LOG("timing #%i: %3i ms", i, timings[i]);
+	}
+
+	return ret;
+}
+
+static int dump_max17135_vcom(struct max17135 *p)
+{
+	char vcom_raw;
+
+	if (g_hw->max17135_get_vcom(p, &vcom_raw) < 0) {
+		LOG("failed to read VCOM");
+		return -1;
+	}
+
+	LOG("VCOM: %i (0x%02X)", vcom_raw, vcom_raw);
+
+	return 0;
+}
+
+static int dump_max17135_temperature(struct max17135 *p)
+{
+	int sensor_en;
+	short temp_i, temp_e;
+	float temp_i_f, temp_e_f;
+	int ret = 0;
+
+	sensor_en = g_hw->max17135_get_temp_sensor_en(p);
+
+	if (sensor_en < 0) {
+		LOG("failed to get the temperature sensor state");
+		ret = -1;
+	} else {
+		LOG("temperature sensor enabled: %s", sensor_en ? "yes":"no");
+	}
+
+	if ((g_hw->max17135_get_temperature(p, &temp_i, MAX17135_TEMP_INT) < 0)
+	    || (g_hw->max17135_get_temperature(p, &temp_e,
+					       MAX17135_TEMP_EXT) < 0)) {
+		LOG("failed to read temperatures");
+		ret = -1;
+	} else {
+		temp_i_f = g_hw->max17135_convert_temperature(p, temp_i);
+		temp_e_f = g_hw->max17135_convert_temperature(p, temp_e);
+		LOG("internal temperature: %.1f C", temp_i_f);
+		LOG("external temperature: %.1f C", temp_e_f);
+	}
+
+	return ret;
+}
+
+/* ----------------------------------------------------------------------------
+ * TPS65185
+ */
+
+static struct tps65185 *require_tps65185(struct ctx *ctx)
+{
+	if (ctx->tps65185 == NULL)
+		ctx->tps65185 = g_hw->tps65185_init(g_i2c_bus, g_i2c_addr);
+
+	return ctx->tps65185;
+}
+
+static int run_tps65185(struct ctx *ctx, int argc, char **argv)
+{
+	struct tps65185 *tps65185 = require_tps65185(ctx);
+	const char *cmd_str;
+
+	if (tps65185 == NULL)
+		return -1;
+
+	if (argc == 0)
+		return dump_tps65185_state(tps65185);
+
+	cmd_str = argv[0];
+
+	if (!strcmp(cmd_str, "vcom"))
+		return run_tps65185_vcom(tps65185, argc - 1, &argv[1]);
+
+	if (!strcmp(cmd_str, "seq"))
+		return run_tps65185_seq(tps65185, argc - 1, &argv[1]);
+
+	if (!strcmp(cmd_str, "active"))
+		return g_hw->tps65185_set_power(tps65185, TPS65185_ACTIVE);
+
+	if (!strcmp(cmd_str, "standby"))
+		return g_hw->tps65185_set_power(tps65185, TPS65185_STANDBY);
+
+	if (!strcmp(cmd_str, "en"))
+		return run_tps65185_en(tps65185, argc - 1, &argv[1]);
+
+	LOG("unsupported command: %s", cmd_str);
+
+	return -1;
+}
+
+static int run_tps65185_vcom(struct tps65185 *p, int argc, char **argv)
+{
+	int vcom_raw;
+
+	if (argc == 0) {
+		uint16_t vcom;
+
+		if (g_hw->tps65185_get_vcom(p, &vcom))
+			return -1;
+
+		printf("%d\n", vcom);
+
+		return 0;
+	}
+
+	vcom_raw = atoi(argv[0]);
+
+	if ((vcom_raw < 0) || (vcom_raw > 0x1FF)) {
+		LOG("invalid VCOM value %d (value: 0 - 511)", vcom_raw);
+		return -1;
+	}
+
+	LOG("setting VCOM to %d (0x%04X)", vcom_raw, vcom_raw);
+
+	return g_hw->tps65185_set_vcom(p, (uint16_t)vcom_raw);
+}
+
+static int run_tps65185_seq(struct tps65185 *p, int argc, char **argv)
+{
+	struct tps65185_seq seq;
+	const char *up_down_str;
+	int up;
+	int i;
+	char **it;
+
+	if (argc < 1) {
+		LOG("invalid arguments");
+		return -1;
+	}
+
+	up_down_str = argv[0];
+
+	if (!strcmp(up_down_str, "up")) {
+		up = 1;
+	} else if (!strcmp(up_down_str, "down")) {
+		up = 0;
+	} else {
+		LOG("invalid up/down identifier");
+		return -1;
+	}
+
+	if (argc == 1) {
+		if (g_hw->tps65185_get_seq(p, &seq, up))
+			return -1;
+
+		dump_tps65185_seq_item("VDDH", seq.vddh, &seq);
+		dump_tps65185_seq_item("VPOS", seq.vpos, &seq);
+		dump_tps65185_seq_item("VEE", seq.vee, &seq);
+		dump_tps65185_seq_item("VNEG", seq.vneg, &seq);
+
+		return 0;
+	}
+
+	if (argc != 9) {
+		LOG("invalid sequence arguments");
+		return -1;
+	}
+
+	it = &argv[1];
+
+	{
+		enum tps65185_strobe * const strobes[4] = {
+			&seq.vddh, &seq.vpos, &seq.vee, &seq.vneg
+		};
+
+		for (i = 0; i < 4; ++i) {
+			const int value = atoi(*it++);
+
+			if ((value < 1) || (value > 4)) {
+				LOG("invalid strobe value: %d (1-4)", value);
+				return -1;
+			}
+
+			*strobes[i] = value - 1;
+		}
+	}
+
+	{
+		enum tps65185_delay * const delays[4] = {
+			&seq.strobe1, &seq.strobe2, &seq.strobe3, &seq.strobe4
+		};
+
+		for (i = 0; i < 4; ++i) {
+			const int value = atoi(*it++);
+
+			if ((value < 3) || (value > 12) || (value % 3)) {
+				LOG("invalid strobe delay value: %d", value);
+				return -1;
+			}
+
+			*delays[i] = (value / 3) - 1;
+		}
+	}
+
+	return g_hw->tps65185_set_seq(p, &seq, up);
+}
+
+static int run_tps65185_en(struct tps65185 *p, int argc, char **argv)
+{
+	const char *en_str;
+	enum tps65185_en_id id;
+	int on;
+
+	if (argc == 0) {
+		LOG("no power rail identifier provided");
+		return -1;
+	}
+
+	en_str = argv[0];
+
+	for (id = 0; id < 6; ++id)
+		if (!strcmp(en_str, tps65185_en_id_str[id]))
+			break;
+
+	if (id == 6) {
+		LOG("invalid power rail identifier: %s", en_str);
+		return -1;
+	}
+
+	if (argc == 1) {
+		on = g_hw->tps65185_get_en(p, id);
+
+		if (on < 0)
+			return -1;
+
+		LOG("%s: %s", en_str, on ? "on" : "off");
+
+		return 0;
+	}
+
+	on = get_on_off_opt(argv[1]);
+
+	if (on < 0)
+		return -1;
+
+	return g_hw->tps65185_set_en(p, id, on);
+}
+
+static int dump_tps65185_state(struct tps65185 *p)
+{
+	struct tps65185_info info;
+	struct tps65185_seq seq;
+	uint16_t vcom;
+	enum tps65185_en_id en_id;
+
+	g_hw->tps65185_get_info(p, &info);
+	LOG("version: %d.%d.%d", info.version, info.major, info.minor);
+
+	if (g_hw->tps65185_get_vcom(p, &vcom)) {
+		LOG("failed to read VCOM...");
+		return -1;
+	}
+
+	LOG("VCOM: %d (0x%04X)", vcom, vcom);
+
+	if (g_hw->tps65185_get_seq(p, &seq, 1))
+		return -1;
+
+	LOG("Power up sequence:");
+	dump_tps65185_seq_item("VDDH", seq.vddh, &seq);
+	dump_tps65185_seq_item("VPOS", seq.vpos, &seq);
+	dump_tps65185_seq_item("VEE", seq.vee, &seq);
+	dump_tps65185_seq_item("VNEG", seq.vneg, &seq);
+
+	if (g_hw->tps65185_get_seq(p, &seq, 0))
+		return -1;
+
+	LOG("Power down sequence:");
+	dump_tps65185_seq_item("VDDH", seq.vddh, &seq);
+	dump_tps65185_seq_item("VPOS", seq.vpos, &seq);
+	dump_tps65185_seq_item("VEE", seq.vee, &seq);
+	dump_tps65185_seq_item("VNEG", seq.vneg, &seq);
+
+	LOG("Power rail states:");
+	for (en_id = 0; en_id < 6; ++en_id) {
+		int en = g_hw->tps65185_get_en(p, en_id);
+
+		if (en < 0)
+			return -1;
+
+		LOG("%s: %s", tps65185_en_id_str[en_id], en ? "on" : "off");
+	}
+
+	return 0;
+}
+
+static void dump_tps65185_seq_item(const char *name,
+				   enum tps65185_strobe strobe,
+				   const struct tps65185_seq *seq)
+{
+	enum tps65185_delay delay;
+
+	switch (strobe) {
+	case TPS65185_STROBE1:
+		delay = seq->strobe1;
+		break;
+	case TPS65185_STROBE2:
+		delay = seq->strobe2;
+		break;
+	case TPS65185_STROBE3:
+		delay = seq->strobe3;
+		break;
+	case TPS65185_STROBE4:
+		delay = seq->strobe4;
+		break;
+	default:
+		assert(!"invalid strobe identifier");
+		return;
+	}
+
+	LOG("%5s: STROBE%d (%d ms)", name, (strobe + 1), ((delay + 1) * 3));
+}
+
+/* ----------------------------------------------------------------------------
+ * DAC
+ */
+
+static struct dac5820 *require_dac(struct ctx *ctx)
+{
+	if (ctx->dac == NULL)
+		ctx->dac = g_hw->dac5820_init(g_i2c_bus, g_i2c_addr);
+
+	return ctx->dac;
+}
+
+static int run_dac(struct ctx *ctx, int argc, char **argv)
+{
+	struct dac5820 *dac = require_dac(ctx);
+	const char *channel_str;
+	const char *arg_str;
+	enum dac5820_channel_id channel_id;
+	int value;
+
+	if (dac == NULL)
+		return -1;
+
+	if (argc < 2) {
+		LOG("invalid arguments");
+		return -1;
+	}
+
+	channel_str = argv[0];
+	arg_str = argv[1];
+
+	if (!strcmp(channel_str, "A")) {
+		channel_id = DAC5820_CH_A;
+	} else if (!strcmp(channel_str, "B")) {
+		channel_id = DAC5820_CH_B;
+	}  else {
+		LOG("invalid channel identifier (A or B)");
+		return -1;
+	}
+
+	if (!strcmp(arg_str, "on"))
+		return g_hw->dac5820_set_power(dac, channel_id, DAC5820_POW_ON);
+
+	if (!strcmp(arg_str, "off"))
+		return g_hw->dac5820_set_power(dac, channel_id,
+					 DAC5820_POW_OFF_FLOAT);
+
+	if (!strcmp(arg_str, "off1k"))
+		return g_hw->dac5820_set_power(dac, channel_id,
+					 DAC5820_POW_OFF_1K);
+
+	if (!strcmp(arg_str, "off100k"))
+		return g_hw->dac5820_set_power(dac, channel_id,
+					 DAC5820_POW_OFF_100K);
+
+	value = atoi(arg_str);
+
+	if ((value < 0) || (value > 0xFF)) {
+		LOG("invalid value %i (valid: 0 - 255)", value);
+		return -1;
+	}
+
+	return g_hw->dac5820_output(dac, channel_id, value);
+}
+
+/* ----------------------------------------------------------------------------
+ * ADC
+ */
+
+static int run_adc(struct ctx *ctx, int argc, char **argv)
+{
+	struct adc11607 *adc;
+	enum adc11607_ref_id ref;
+	adc11607_result_t result;
+	int nb_chans;
+	int chan;
+
+	if (ctx->adc == NULL)
+		ctx->adc = g_hw->adc11607_init(g_i2c_bus, g_i2c_addr);
+
+	if (ctx->adc == NULL)
+		return -1;
+
+	adc = ctx->adc;
+	nb_chans = g_hw->adc11607_get_nb_channels(adc);
+
+	if (argc > 0) {
+		const char *ref_str = argv[0];
+
+		if (!strcmp(ref_str, "internal")) {
+			ref = ADC11607_REF_INTERNAL;
+		} else if (!strcmp(ref_str, "external")) {
+			/* ToDo: set the external reference voltage value */
+			ref = ADC11607_REF_EXTERNAL;
+		} else if (!strcmp(ref_str, "vdd")) {
+			ref = ADC11607_REF_VDD;
+		} else {
+			LOG("invalid reference voltage");
+			return -1;
+		}
+	} else {
+		ref = ADC11607_REF_INTERNAL;
+	}
+
+	if (g_hw->adc11607_set_ref(adc, ref) < 0) {
+		LOG("failed to select reference voltage");
+		return -1;
+	}
+
+	if (g_hw->adc11607_read_results(adc) < 0) {
+		LOG("failed to read the ADC results");
+		return -1;
+	}
+
+	if (argc > 1) {
+		static const float VCOM_COEFF = 10.0;
+		const char *chan_arg = argv[1];
+
+		if (!strcmp(chan_arg, "vcom")) {
+			result = g_hw->adc11607_get_result(adc, 1);
+
+			if (result == ADC11607_INVALID_RESULT) {
+				LOG("invalid result");
+				return -1;
+			}
+
+			printf("%f\n", g_hw->adc11607_get_volts(adc, result)
+			       * VCOM_COEFF);
+
+			return 0;
+		}
+
+		chan = atoi(chan_arg);
+
+		if ((chan < 0) || (chan >= nb_chans)) {
+			LOG("invalid channel number (0-%i)", (nb_chans - 1));
+			return -1;
+		}
+
+		result = g_hw->adc11607_get_result(adc, chan);
+
+		if (result == ADC11607_INVALID_RESULT) {
+			LOG("invalid result");
+			return -1;
+		}
+
+		printf("%f\n", g_hw->adc11607_get_volts(adc, result));
+
+		return 0;
+	}
+
+	for (chan = 0; chan < nb_chans; ++chan) {
+		result = g_hw->adc11607_get_result(adc, chan);
+
+		if (result == ADC11607_INVALID_RESULT) {
+			LOG("invalid result");
+			return -1;
+		}
+
+		LOG("ch. %i, result: %i (%.3f V, %i mV)", chan, result,
+		    g_hw->adc11607_get_volts(adc, result),
+		    g_hw->adc11607_get_millivolts(adc, result));
+	}
+
+	return 0;
+}
+
+/* ----------------------------------------------------------------------------
+ * GPIO Expanders
+ */
+
+static int run_pbtn(struct ctx *ctx, int argc, char **argv)
+{
+	const char *gpio = plconfig_get_str(ctx->config, "pbtn-gpio", NULL);
+	struct gpio_event event;
+	struct gpio_event *ev = NULL;
+	struct pbtn *pbtn;
+	int btn;
+	int ret = 0;
+
+	if (g_opt != NULL) {
+		if (strncmp(g_opt, "gpio=", 5)) {
+			LOG("invalid pbtn option: %s", g_opt);
+			return -1;
+		}
+
+		gpio = &g_opt[5];
+	}
+
+	if (ctx->pbtn == NULL)
+		ctx->pbtn = g_hw->pbtn_init(g_i2c_bus, g_i2c_addr);
+
+	if (ctx->pbtn == NULL)
+		return -1;
+
+	if (gpio != NULL) {
+		if (open_gpio_event(gpio, &event))
+			LOG("failed to open the GPIO (%s), polling instead",
+			    gpio);
+		else
+			ev = &event;
+	}
+
+	pbtn = ctx->pbtn;
+	g_hw->pbtn_set_abort_cb(pbtn, pbtn_abort_cb);
+
+	LOG("Type Ctrl-C to abort");
+
+	LOG("waiting for button #7 on");
+	btn = wait_pbtn(pbtn, ev, PBTN_7, 1, 0);
+	LOG("result: %i", btn);
+
+	if (btn < 0)
+		ret = -1;
+
+	LOG("waiting for button #7 off");
+	btn = wait_pbtn(pbtn, ev, PBTN_7, 0, 0);
+	LOG("result: %i", btn);
+
+	if (btn < 0)
+		ret = -1;
+
+	LOG("waiting for button #9 on");
+	btn = wait_pbtn(pbtn, ev, PBTN_9, 1, 0);
+	LOG("result: %i", btn);
+
+	if (btn < 0)
+		ret = -1;
+
+	LOG("please release all buttons now");
+	btn = wait_pbtn(pbtn, ev, PBTN_ALL, 0, 0);
+	LOG("thanks");
+
+	if (btn < 0)
+		ret = -1;
+
+	LOG("waiting for any button on");
+	btn = wait_pbtn(pbtn, ev, PBTN_ALL, 1, 1);
+	LOG("result: 0x%02X", btn);
+
+	if (btn < 0)
+		ret = -1;
+
+	g_hw->pbtn_set_abort_cb(pbtn, NULL);
+
+	if (ev != NULL)
+		close_gpio_event(ev);
+
+	return ret;
+}
+
+static int pbtn_abort_cb(void)
+{
+	return g_abort ? -1 : 0;
+}
+
+/* -- GPIO line events -- */
+
+/* Instead of polling the devices over I2C, wait for an edge on their
+ * interrupt or status line with the GPIO character device and then read
+ * their state once.  The line is given as CHIP:LINE[:active_low] with CHIP
+ * a /dev/gpiochipN device, or as fd:N to use an open file descriptor such as
+ * a pipe where any data is an event. */
+
+#define GPIO_POK_TIMEOUT_MS 1000
+
+static int open_gpio_event(const char *spec, struct gpio_event *ev)
+{
+	unsigned long fd;
+
+	ev->has_value = 0;
+
+	if (!strncmp(spec, "fd:", 3)) {
+		if (parse_ul(&spec[3], &fd) || (fd > INT_MAX))
+			return -1;
+
+		ev->fd = fd;
+		ev->owned = 0;
+
+		return 0;
+	}
+
+#ifdef GPIO_V2_GET_LINE_IOCTL
+	{
+		struct gpio_v2_line_request req;
+		char *buffer = strdup(spec);
+		char *it = buffer;
+		const char *chip;
+		const char *line;
+		const char *flag;
+		unsigned long offset;
+		int chip_fd;
+		int ret;
+
+		assert(buffer != NULL);
+		chip = strsep(&it, ":");
+		line = strsep(&it, ":");
+		flag = it;
+
+		if ((line == NULL) || parse_ul(line, &offset)
+		    || ((flag != NULL) && strcmp(flag, "active_low"))) {
+			free(buffer);
+			return -1;
+		}
+
+		memset(&req, 0, sizeof(req));
+		req.offsets[0] = offset;
+		req.num_lines = 1;
+		strcpy(req.consumer, "plhwtools");
+		req.config.flags = GPIO_V2_LINE_FLAG_INPUT
+			| GPIO_V2_LINE_FLAG_EDGE_RISING
+			| GPIO_V2_LINE_FLAG_EDGE_FALLING;
+
+		if (flag != NULL)
+			req.config.flags |= GPIO_V2_LINE_FLAG_ACTIVE_LOW;
+
+		chip_fd = open(chip, O_RDONLY);
+		free(buffer);
+
+		if (chip_fd < 0)
+			return -1;
+
+		ret = ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &req);
+		close(chip_fd);
+
+		if (ret < 0)
+			return -1;
+
+		ev->fd = req.fd;
+		ev->owned = 1;
+		ev->has_value = 1;
+
+		return 0;
+	}
+#else
+	LOG("GPIO character device not supported");
+
+	return -1;
+#endif
+}
+
+static void close_gpio_event(struct gpio_event *ev)
+{
+	if (ev->owned)
+		close(ev->fd);
+}
+
+/* Return the active state of the line, or -1 when it is not known */
+static int get_gpio_event_value(struct gpio_event *ev)
+{
+#ifdef GPIO_V2_LINE_GET_VALUES_IOCTL
+	struct gpio_v2_line_values values = { .bits = 0, .mask = 1 };
+
+	if (ev->has_value
+	    && !ioctl(ev->fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values))
+		return (values.bits & 1) ? 1 : 0;
+#endif
+
+	return -1;
+}
+
+/* Return 1 after the events received, 0 on timeout or -1 on error */
+static int wait_gpio_event(struct gpio_event *ev, int timeout_ms)
+{
+	struct pollfd pfd = { .fd = ev->fd, .events = POLLIN };
+	char events[256];
+	int ret;
+
+	ret = poll(&pfd, 1, timeout_ms);
+
+	if (ret <= 0)
+		return ((ret < 0) && (errno != EINTR)) ? -1 : 0;
+
+	/* All the pending events are read, the state is read separately */
+	if (read(ev->fd, events, sizeof(events)) <= 0)
+		return -1;
+
+	return 1;
+}
+
+/* Match the buttons state the same way as pbtn_wait() and pbtn_wait_any() */
+static int match_pbtn(int state, int btns, int on, int any)
+{
+	if (!any)
+		return on ? ((state & btns) == btns) : !(state & btns);
+
+	return on ? ((state & btns) != 0) : ((state & btns) != btns);
+}
+
+/* Read the buttons once with pbtn_read_state() and then only again after
+ * each event on the GPIO line until they match.  The result is the same as
+ * with pbtn_wait() or pbtn_wait_any(). */
+static int wait_pbtn(struct pbtn *pbtn, struct gpio_event *ev, int btns,
+		     int on, int any)
+{
+	int ret = 0;
+
+	if (ev == NULL)
+		return any ? g_hw->pbtn_wait_any(pbtn, btns, on) :
+			g_hw->pbtn_wait(pbtn, btns, on);
+
+	while (!g_abort) {
+		const int state = g_hw->pbtn_read_state(pbtn);
+
+		if (state < 0) {
+			LOG("failed to read the buttons");
+			return -1;
+		}
+
+		if (match_pbtn(state, btns, on, any))
+			return any ? (state & btns) : state;
+
+		while (!g_abort && !(ret = wait_gpio_event(ev, 100)));
+
+		if (ret < 0) {
+			LOG("failed to wait for the GPIO");
+			return -1;
+		}
+	}
+
+	return -1;
+}
+
+/* The line may already be active when it is requested, then the POK status
+ * is confirmed with max17135_wait_for_pok() which returns after reading it
+ * once when it is already OK. */
+static int wait_pok(struct max17135 *max17135, const char *gpio)
+{
+	const unsigned long long timeout_us =
+		get_time_us() + (GPIO_POK_TIMEOUT_MS * 1000ULL);
+	struct gpio_event ev;
+	int ret = 0;
+
+	if (open_gpio_event(gpio, &ev)) {
+		LOG("failed to open the POK GPIO (%s), polling instead", gpio);
+		return g_hw->max17135_wait_for_pok(max17135);
+	}
+
+	while (!g_abort && (get_gpio_event_value(&ev) != 1)) {
+		const unsigned long long now = get_time_us();
+
+		if (now >= timeout_us) {
+			LOG("no POK event, polling instead");
+			break;
+		}
+
+		ret = wait_gpio_event(&ev, ((timeout_us - now + 999) / 1000));
+
+		if (ret < 0) {
+			LOG("failed to wait for the POK GPIO, polling instead");
+			break;
+		}
+
+		if (ret && !ev.has_value)
+			break;
+	}
+
+	close_gpio_event(&ev);
+
+	if (g_abort)
+		return -1;
+
+	return g_hw->max17135_wait_for_pok(max17135);
+}
+
+/* ----------------------------------------------------------------------------
+ * EEPROM
+ */
+
+static int run_eeprom(struct ctx *ctx, int argc, char **argv)
+{
+	struct eeprom *eeprom;
+	struct eeprom_opt eeprom_opt;
+	const char *eeprom_mode;
+	const char *cmd_str;
+	int fd;
+	unsigned i2c_addr;
+	size_t esize;
+	const char *f_name;
+	struct stat st;
+	int write_file;
+	int is_reg;
+	size_t i;
+	int ret;
+
+	if (argc < 2) {
+		LOG("invalid arguments");
+		return -1;
+	}
+
+	eeprom_mode = argv[0];
+	cmd_str = argv[1];
+
+	i2c_addr = g_i2c_addr;
+	eeprom_opt.i2c_addr = PLHW_NO_I2C_ADDR;
+	eeprom_opt.data_size = 0;
+	eeprom_opt.skip = 0;
+	eeprom_opt.zero_padding = 0;
+	eeprom_opt.block_size = 0;
+	eeprom_opt.page_size = 0;
+	eeprom_opt.mode_page_size = get_eeprom_mode_page_size(eeprom_mode);
+	eeprom_opt.buffer_size = 4096;
+	eeprom_opt.pipeline = 0;
+	eeprom_opt.write_mode = EEPROM_WRITE_ALL;
+	eeprom_opt.compress = EEPROM_COMPRESS_AUTO;
+	eeprom_opt.pattern = EEPROM_PATTERN_RANDOM;
+	eeprom_opt.seed = 0;
+	eeprom_opt.journal[0] = '\0';
+	eeprom_opt.resume = 0;
+	eeprom_opt.cache[0] = '\0';
+	eeprom_opt.n_ranges = 0;
+	eeprom_opt.hexdump = 0;
+	eeprom_opt.force = 0;
+	eeprom_opt.n_bench_blocks = 0;
+	eeprom_opt.n_bench_pages = 0;
+	eeprom_opt.n_bench_lengths = 0;
+
+	if (g_opt != NULL)
+		if (parse_eeprom_opt(ctx, &eeprom_opt))
+			return -1;
+
+	/* Other commands would leave stale copies in the cache */
+	if (eeprom_opt.cache[0] && strcmp(cmd_str, "e2f")
+	    && strcmp(cmd_str, "f2e")) {
+		LOG("cache only supported with e2f and f2e");
+		return -1;
+	}
+
+	if (eeprom_opt.n_ranges && strcmp(cmd_str, "e2f")
+	    && strcmp(cmd_str, "f2e") && strcmp(cmd_str, "verify")) {
+		LOG("ranges only supported with e2f, f2e and verify");
+		return -1;
+	}
+
+	if (eeprom_opt.i2c_addr != PLHW_NO_I2C_ADDR)
+		i2c_addr = eeprom_opt.i2c_addr;
+	else
+		i2c_addr = g_i2c_addr;
+
+	/* Gang programming uses its own EEPROM instances, one per target */
+	if (!strcmp(cmd_str, "gang"))
+		return gang_eeprom(eeprom_mode, i2c_addr, (argc - 2), &argv[2],
+				   &eeprom_opt);
+
+	/* Re-use the EEPROM instance from a previous script command only if it
+	 * was created with the same mode, address and transfer sizes. */
+	if ((ctx->eeprom != NULL)
+	    && (strcmp(ctx->eeprom_mode, eeprom_mode)
+		|| (ctx->eeprom_i2c_addr != i2c_addr)
+		|| (ctx->eeprom_block_size != eeprom_opt.block_size)
+		|| (ctx->eeprom_page_size != eeprom_opt.page_size))) {
+		g_hw->eeprom_free(ctx->eeprom);
+		ctx->eeprom = NULL;
+		free(ctx->eeprom_mode);
+		ctx->eeprom_mode = NULL;
+	}
+
+	if (ctx->eeprom == NULL) {
+		ctx->eeprom = g_hw->eeprom_init(g_i2c_bus, i2c_addr,
+						eeprom_mode);
+
+		if (ctx->eeprom == NULL)
+			return -1;
+
+		ctx->eeprom_mode = strdup(eeprom_mode);
+		assert(ctx->eeprom_mode != NULL);
+		ctx->eeprom_i2c_addr = i2c_addr;
+		ctx->eeprom_block_size = eeprom_opt.block_size;
+		ctx->eeprom_page_size = eeprom_opt.page_size;
+	}
+
+	eeprom = ctx->eeprom;
+
+	esize = g_hw->eeprom_get_size(eeprom);
+
+	if (!eeprom_opt.data_size) {
+		eeprom_opt.data_size = esize;
+	} else if (eeprom_opt.data_size > esize) {
+		LOG("data size bigger than EEPROM size");
+		return -1;
+	}
+
+	for (i = 0; i < eeprom_opt.n_ranges; ++i) {
+		const struct eeprom_range *range = &eeprom_opt.ranges[i];
+
+		if ((range->offset >= esize)
+		    || (range->size > (esize - range->offset))) {
+			LOG("range out of the EEPROM: 0x%04zX+%zu",
+			    range->offset, range->size);
+			return -1;
+		}
+	}
+
+	if (eeprom_opt.block_size)
+		g_hw->eeprom_set_block_size(eeprom, eeprom_opt.block_size);
+
+	if (eeprom_opt.page_size)
+		g_hw->eeprom_set_page_size(eeprom, eeprom_opt.page_size);
+
+	if (!strcmp(cmd_str, "full_rw")) {
+		if (!confirm_eeprom_overwrite())
+			return -1;
+
+		return full_rw_eeprom(eeprom, &eeprom_opt);
+	}
+
+	if (!strcmp(cmd_str, "bench")) {
+		if (!confirm_eeprom_overwrite())
+			return -1;
+
+		return bench_eeprom(eeprom, eeprom_mode, &eeprom_opt);
+	}
+
+	if (!strcmp(cmd_str, "probe")) {
+		if (!confirm_eeprom_overwrite())
+			return -1;
+
+		return probe_eeprom(eeprom, &eeprom_opt);
+	}
+
+	if (!strcmp(cmd_str, "get"))
+		return get_disp_data(eeprom, ((argc > 2) ? argv[2] : NULL),
+				     &eeprom_opt);
+
+	if (!strcmp(cmd_str, "set")) {
+		if (argc < 4) {
+			LOG("invalid arguments");
+			return -1;
+		}
+
+		return set_disp_data(eeprom, argv[2], argv[3], &eeprom_opt);
+	}
+
+	if (!strcmp(cmd_str, "fill")) {
+		if (argc < 3) {
+			LOG("invalid arguments");
+			return -1;
+		}
+
+		return fill_eeprom(eeprom, argv[2], &eeprom_opt);
+	}
+
+	if (!strcmp(cmd_str, "sum"))
+		return sum_eeprom(eeprom, ((argc > 2) ? argv[2] : "crc32c"),
+				  ((argc > 3) ? argv[3] : NULL), &eeprom_opt);
+
+	if (!strcmp(cmd_str, "e2f")) {
+		write_file = 1;
+	} else if (!strcmp(cmd_str, "f2e")) {
+		write_file = 0;
+	} else if (!strcmp(cmd_str, "verify")) {
+		write_file = 0;
+		eeprom_opt.write_mode = EEPROM_WRITE_VERIFY;
+	} else {
+		LOG("invalid arguments");
+		return -1;
+	}
+
+	if ((argc < 3) && !write_file && g_serving) {
+		LOG("a file name is required when serving requests");
+		return -1;
+	} else if (argc < 3) {
+		fd = write_file ? STDOUT_FILENO : STDIN_FILENO;
+		f_name = NULL;
+	} else {
+		static const int write_flags = (O_RDWR | O_CREAT | O_TRUNC);
+		static const int read_flags = (O_RDONLY);
+		const int flags = write_file ? write_flags : read_flags;
+
+		f_name = argv[2];
+		fd = open(f_name, flags);
+
+		if (fd < 0) {
+			LOG("failed to open the file (%s)", f_name);
+			return -1;
+		}
+	}
+
+	if (eeprom_opt.compress == EEPROM_COMPRESS_AUTO) {
+		const size_t len = (f_name != NULL) ? strlen(f_name) : 0;
+
+		if ((len > 3) && !strcmp(&f_name[len - 3], ".gz"))
+			eeprom_opt.compress = EEPROM_COMPRESS_GZIP;
+		else
+			eeprom_opt.compress = EEPROM_COMPRESS_NONE;
+	}
+
+	is_reg = (f_name != NULL) && !fstat(fd, &st) && S_ISREG(st.st_mode);
+
+	/* Regular files are mapped in memory, pipes are streamed and
+	 * compressed files and hexdumps always use the pipeline to format the
+	 * data at the same time as the I2C transfers. */
+	if (eeprom_opt.hexdump && !write_file) {
+		LOG("hexdump only supported with e2f");
+		ret = -1;
+	} else if (eeprom_opt.resume && !eeprom_opt.journal[0]) {
+		LOG("resume only supported with journal");
+		ret = -1;
+	} else if (eeprom_opt.cache[0]
+		   && (eeprom_opt.n_ranges || eeprom_opt.journal[0]
+		       || eeprom_opt.hexdump
+		       || (eeprom_opt.compress != EEPROM_COMPRESS_NONE))) {
+		LOG("cache not supported with ranges, journal, hexdump or "
+		    "compression");
+		ret = -1;
+	} else if (eeprom_opt.cache[0] && write_file) {
+		ret = cache_file_eeprom(eeprom, fd, is_reg, &eeprom_opt);
+	} else if (eeprom_opt.n_ranges) {
+		if (!is_reg || eeprom_opt.journal[0] || eeprom_opt.pipeline
+		    || eeprom_opt.hexdump
+		    || (eeprom_opt.compress != EEPROM_COMPRESS_NONE)) {
+			LOG("ranges only supported with regular files");
+			ret = -1;
+		} else {
+			ret = ranges_file_eeprom(eeprom, fd, write_file, esize,
+						 &eeprom_opt);
+		}
+	} else if (eeprom_opt.journal[0]
+	    && (write_file || !is_reg || eeprom_opt.pipeline
+		|| (eeprom_opt.compress != EEPROM_COMPRESS_NONE)
+		|| (eeprom_opt.write_mode == EEPROM_WRITE_VERIFY))) {
+		LOG("journal only supported with f2e and regular files");
+		ret = -1;
+	} else if (eeprom_opt.pipeline || eeprom_opt.hexdump
+		   || (eeprom_opt.compress != EEPROM_COMPRESS_NONE)) {
+		ret = pipe_file_eeprom(eeprom, fd, write_file, &eeprom_opt);
+	} else if (is_reg) {
+		ret = map_file_eeprom(eeprom, fd, write_file, &eeprom_opt);
+	} else {
+		ret = rw_file_eeprom(eeprom, fd, write_file, &eeprom_opt);
+	}
+
+	if (!ret && !g_abort && eeprom_opt.cache[0] && !write_file
+	    && (eeprom_opt.write_mode != EEPROM_WRITE_VERIFY))
+		ret = refresh_eeprom_cache(eeprom, fd, is_reg, &eeprom_opt);
+
+	if (f_name != NULL) {
+		if (write_file) {
+			if (fchmod(fd, 0444) < 0) {
+				LOG("Warning: chmod failed");
+			}
+		}
+
+		close(fd);
+	}
+
+	return ret;
+}
+
+static int confirm_eeprom_overwrite(void)
+{
+	char c;
+
+	if (disable_stdin_buffering() < 0)
+		LOG("Warning: failed to disable input buffering");
+
+	LOG_PRINT("Warning: this will overwrite the EEPROM data.\n"
+		  "Continue ? [N/y] ");
+	c = fgetc(stdin);
+	LOG_PRINT("\n");
+
+	if (restore_stdin_termios() < 0)
+		LOG("Warning: failed to restore input buffering");
+
+	if (c != 'y') {
+		LOG_PRINT("aborted\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Each pattern byte only depends on its offset and the seed, so the
+ * expected data can be generated again when reading it back.  With
+ * EEPROM_PATTERN_BYTE, the seed is the value of all the bytes. */
+static void fill_eeprom_pattern(enum eeprom_pattern pattern, uint64_t seed,
+				size_t offset, char *data, size_t size)
+{
+	size_t i;
+
+	switch (pattern) {
+	case EEPROM_PATTERN_RANDOM:
+		while (size) {
+			const uint64_t word = splitmix64(seed ^ (offset / 8));
+			const size_t first = offset % 8;
+			const size_t n = min((8 - first), size);
+
+			for (i = 0; i < n; ++i)
+				*data++ = word >> ((first + i) * 8);
+
+			offset += n;
+			size -= n;
+		}
+		break;
+
+	case EEPROM_PATTERN_WALKING:
+		for (i = 0; i < size; ++i)
+			data[i] = 1 << ((offset + i) % 8);
+		break;
+
+	case EEPROM_PATTERN_ADDRESS:
+		for (i = 0; i < size; ++i)
+			data[i] = (offset + i) ^ ((offset + i) >> 8);
+		break;
+
+	case EEPROM_PATTERN_CHECKER:
+		for (i = 0; i < size; ++i)
+			data[i] = ((offset + i) & 1) ? 0xAA : 0x55;
+		break;
+
+	case EEPROM_PATTERN_BYTE:
+		memset(data, (seed & 0xFF), size);
+		break;
+	}
+}
+
+/* Return the number of different bytes and add the flipped bits to the
+ * histogram.  The data is compared 64 bits at a time when different. */
+static size_t compare_eeprom_data(const char *expected, const char *data,
+				  size_t size, unsigned long *bit_flips)
+{
+	size_t n_bytes = 0;
+	size_t i = 0;
+	int bit;
+
+	if (!memcmp(expected, data, size))
+		return 0;
+
+	for (; (i + 8) <= size; i += 8) {
+		uint64_t a;
+		uint64_t b;
+		uint64_t diff;
+
+		memcpy(&a, &expected[i], 8);
+		memcpy(&b, &data[i], 8);
+		diff = a ^ b;
+
+		if (!diff)
+			continue;
+
+		for (; diff; diff >>= 8) {
+			if (!(diff & 0xFF))
+				continue;
+
+			++n_bytes;
+
+			for (bit = 0; bit < 8; ++bit)
+				if (diff & (1 << bit))
+					bit_flips[bit]++;
+		}
+	}
+
+	for (; i < size; ++i) {
+		const unsigned char diff = expected[i] ^ data[i];
+
+		if (!diff)
+			continue;
+
+		++n_bytes;
+
+		for (bit = 0; bit < 8; ++bit)
+			if (diff & (1 << bit))
+				bit_flips[bit]++;
+	}
+
+	return n_bytes;
+}
+
+static void log_eeprom_bit_flips(const char *name,
+				 const unsigned long *bit_flips)
+{
+	LOG("%s bit flips [7..0]: %lu %lu %lu %lu %lu %lu %lu %lu", name,
+	    bit_flips[7], bit_flips[6], bit_flips[5], bit_flips[4],
+	    bit_flips[3], bit_flips[2], bit_flips[1], bit_flips[0]);
+}
+
+/* Write the pattern to the EEPROM and read it back, one chunk at a time so
+ * the memory used does not depend on the EEPROM size.  All the errors are
+ * counted and reported for each page. */
+static int full_rw_eeprom(struct eeprom *eeprom, const struct eeprom_opt *opt)
+{
+	static const char *PATTERN_NAMES[] = {
+		[EEPROM_PATTERN_RANDOM] = "random",
+		[EEPROM_PATTERN_WALKING] = "walking ones",
+		[EEPROM_PATTERN_ADDRESS] = "address",
+		[EEPROM_PATTERN_CHECKER] = "checkerboard",
+		[EEPROM_PATTERN_BYTE] = "constant byte",
+	};
+	const size_t page_size = get_eeprom_page_size(opt);
+	const size_t chunk_size = (opt->buffer_size > page_size) ?
+		(opt->buffer_size - (opt->buffer_size % page_size)) : page_size;
+	const size_t dump_size = min(256, min(chunk_size, opt->data_size));
+	const uint64_t seed = opt->seed ? opt->seed : (uint64_t) time(NULL);
+	unsigned long total_flips[8] = { 0 };
+	size_t bad_bytes = 0;
+	size_t bad_pages = 0;
+	char *data_w = malloc(chunk_size);
+	char *data_r = malloc(chunk_size);
+	size_t done;
+	int ret = 0;
+
+	if ((data_w == NULL) || (data_r == NULL)) {
+		LOG("failed to allocate buffers");
+		free(data_r);
+		free(data_w);
+		return -1;
+	}
+
+	LOG("pattern: %s", PATTERN_NAMES[opt->pattern]);
+
+	if (opt->pattern != EEPROM_PATTERN_WALKING)
+		LOG("seed: %llu", (unsigned long long) seed);
+
+	fill_eeprom_pattern(opt->pattern, seed, 0, data_w, dump_size);
+	LOG("beginning of the data to be written:");
+	dump_hex_data(data_w, dump_size);
+
+	g_hw->eeprom_seek(eeprom, 0);
+
+	for (done = 0; (done < opt->data_size) && !g_abort; ) {
+		const size_t n = min(chunk_size, (opt->data_size - done));
+
+		fill_eeprom_pattern(opt->pattern, seed, done, data_w, n);
+
+		if (g_hw->eeprom_write(eeprom, data_w, n) < 0) {
+			LOG_PRINT("\n");
+			LOG("failed to write data");
+			ret = -1;
+			break;
+		}
+
+		done += n;
+		log_eeprom_progress(opt->data_size, (opt->data_size - done),
+				    "Writing");
+	}
+
+	LOG_PRINT("\n");
+	g_hw->eeprom_seek(eeprom, 0);
+
+	for (done = 0; (done < opt->data_size) && !ret && !g_abort; ) {
+		const size_t n = min(chunk_size, (opt->data_size - done));
+		size_t page;
+
+		fill_eeprom_pattern(opt->pattern, seed, done, data_w, n);
+
+		if (g_hw->eeprom_read(eeprom, data_r, n) < 0) {
+			LOG_PRINT("\n");
+			LOG("failed to read data");
+			ret = -1;
+			break;
+		}
+
+		if (!done) {
+			LOG("beginning of the data read back:");
+			dump_hex_data(data_r, dump_size);
+		}
+
+		for (page = 0; page < n; page += page_size) {
+			unsigned long flips[8] = { 0 };
+			const size_t page_n = min(page_size, (n - page));
+			const size_t bad = compare_eeprom_data(
+				&data_w[page], &data_r[page], page_n, flips);
+			char name[64];
+			int bit;
+
+			if (!bad)
+				continue;
+
+			LOG_PRINT("\n");
+			snprintf(name, sizeof(name), "page 0x%04zX: %zu bytes,",
+				 (done + page), bad);
+			log_eeprom_bit_flips(name, flips);
+
+			for (bit = 0; bit < 8; ++bit)
+				total_flips[bit] += flips[bit];
+
+			bad_bytes += bad;
+			bad_pages++;
+		}
+
+		done += n;
+		log_eeprom_progress(opt->data_size, (opt->data_size - done),
+				    "Checking");
+	}
+
+	LOG_PRINT("\n");
+
+	if (bad_pages) {
+		LOG("%zu bytes different in %zu pages", bad_bytes, bad_pages);
+		log_eeprom_bit_flips("total", total_flips);
+		ret = -1;
+	}
+
+	if (g_abort)
+		ret = -1;
+
+	if (!ret)
+		LOG("All good.");
+
+	free(data_r);
+	free(data_w);
+
+	return ret;
+}
+
+static size_t bench_default_list(unsigned long *values,
+				 const unsigned long *defaults, size_t n,
+				 unsigned long min_value,
+				 unsigned long max_value)
+{
+	size_t n_values = 0;
+	size_t i;
+
+	for (i = 0; i < n; ++i) {
+		if ((defaults[i] < min_value) || (defaults[i] > max_value))
+			continue;
+
+		if (n_values && (values[n_values - 1] >= defaults[i]))
+			continue;
+
+		values[n_values++] = defaults[i];
+	}
+
+	return n_values;
+}
+
+/* Each page write is split into transfers no bigger than the block size */
+static size_t bench_count_writes(size_t offset, size_t length,
+				 size_t block_size, size_t page_size)
+{
+	size_t n = 0;
+
+	while (length) {
+		const size_t page_left = page_size - (offset % page_size);
+		const size_t chunk = min(min(block_size, page_left), length);
+
+		offset += chunk;
+		length -= chunk;
+		++n;
+	}
+
+	return n;
+}
+
+static int bench_eeprom(struct eeprom *eeprom, const char *mode,
+			const struct eeprom_opt *opt)
+{
+	static const unsigned long DEF_BLOCKS[] = {
+		16, 32, 64, 96, 128, 256, 512,
+	};
+	const size_t mode_page = get_eeprom_mode_page_size(mode);
+	const unsigned long def_pages[] = {
+		(mode_page / 4), (mode_page / 2), mode_page, (mode_page * 2),
+	};
+	const unsigned long def_lengths[] = {
+		mode_page, 1024, 4096, opt->data_size,
+	};
+	const unsigned long safe_block = opt->block_size ? opt->block_size : 96;
+	const unsigned long safe_page = get_eeprom_page_size(opt);
+	const uint64_t seed = opt->seed ? opt->seed : (uint64_t) time(NULL);
+	unsigned long blocks[EEPROM_BENCH_MAX];
+	unsigned long pages[EEPROM_BENCH_MAX];
+	unsigned long lengths[EEPROM_BENCH_MAX];
+	unsigned long long read_us[EEPROM_BENCH_MAX];
+	size_t n_blocks;
+	size_t n_pages;
+	size_t n_lengths;
+	size_t max_length = 0;
+	unsigned long max_page = safe_page;
+	size_t backup_offset;
+	size_t backup_size;
+	char *backup = NULL;
+	char *data_w = NULL;
+	char *data_r = NULL;
+	size_t n_runs = 0;
+	size_t b, p, l;
+	int ret = 0;
+
+	if (opt->n_bench_blocks) {
+		n_blocks = opt->n_bench_blocks;
+		memcpy(blocks, opt->bench_blocks, sizeof(blocks));
+	} else {
+		n_blocks = bench_default_list(
+			blocks, DEF_BLOCKS,
+			(sizeof(DEF_BLOCKS) / sizeof(DEF_BLOCKS[0])), 1,
+			ULONG_MAX);
+	}
+
+	if (opt->n_bench_pages) {
+		n_pages = opt->n_bench_pages;
+		memcpy(pages, opt->bench_pages, sizeof(pages));
+	} else {
+		n_pages = bench_default_list(
+			pages, def_pages,
+			(sizeof(def_pages) / sizeof(def_pages[0])), 8,
+			opt->data_size);
+	}
+
+	if (opt->n_bench_lengths) {
+		n_lengths = opt->n_bench_lengths;
+		memcpy(lengths, opt->bench_lengths, sizeof(lengths));
+	} else {
+		n_lengths = bench_default_list(
+			lengths, def_lengths,
+			(sizeof(def_lengths) / sizeof(def_lengths[0])), 1,
+			opt->data_size);
+	}
+
+	for (l = 0; l < n_lengths; ++l) {
+		if ((lengths[l] > opt->data_size) || !lengths[l]) {
+			LOG("invalid benchmark length: %lu", lengths[l]);
+			return -1;
+		}
+
+		if (lengths[l] > max_length)
+			max_length = lengths[l];
+	}
+
+	for (p = 0; p < n_pages; ++p) {
+		if (!pages[p]) {
+			LOG("invalid benchmark page size: 0");
+			return -1;
+		}
+
+		if (pages[p] > max_page)
+			max_page = pages[p];
+	}
+
+	/* Writes with a page size bigger than the actual one wrap around
+	 * within the actual pages, so whole pages of the biggest size are
+	 * saved and restored. */
+	backup_offset = (opt->skip / max_page) * max_page;
+	backup_size = ((opt->skip + max_length + max_page - 1) / max_page)
+		* max_page;
+	backup_size = min(backup_size, g_hw->eeprom_get_size(eeprom))
+		- backup_offset;
+
+	backup = malloc(backup_size);
+	data_w = malloc(max_length);
+	data_r = malloc(backup_size);
+
+	if ((backup == NULL) || (data_w == NULL) || (data_r == NULL)) {
+		LOG("failed to allocate buffers");
+		ret = -1;
+		goto exit_free;
+	}
+
+	LOG("saving %zu bytes at offset %zu", backup_size, backup_offset);
+	g_hw->eeprom_set_block_size(eeprom, safe_block);
+	g_hw->eeprom_set_page_size(eeprom, safe_page);
+	g_hw->eeprom_seek(eeprom, backup_offset);
+
+	if (g_hw->eeprom_read(eeprom, backup, backup_size) < 0) {
+		LOG("failed to read the original data");
+		ret = -1;
+		goto exit_free;
+	}
+
+	LOG("seed: %llu", (unsigned long long) seed);
+
+	/* The time spent waiting for the write cycles is the write time minus
+	 * the read time with the same length and block size, which is about
+	 * the time taken by the same transfers on the bus. */
+	printf("# op\tblock_size\tpage_size\tlength\ttime_us\t"
+	       "bytes_per_s\twrites\tus_per_write\twait_us_per_write\t"
+	       "result\n");
+
+	for (b = 0; (b < n_blocks) && !g_abort; ++b) {
+		g_hw->eeprom_set_block_size(eeprom, blocks[b]);
+
+		for (l = 0; (l < n_lengths) && !g_abort; ++l) {
+			unsigned long long t;
+			int stat;
+
+			g_hw->eeprom_seek(eeprom, opt->skip);
+			t = get_time_us();
+			stat = g_hw->eeprom_read(eeprom, data_r, lengths[l]);
+			t = get_time_us() - t;
+			read_us[l] = t;
+
+			printf("read\t%lu\t0\t%lu\t%llu\t%.0f\t0\t0\t0\t%s\n",
+			       blocks[b], lengths[l], t,
+			       (lengths[l] * 1000000.0 / (t ? t : 1)),
+			       (stat < 0) ? "error" : "ok");
+		}
+
+		for (p = 0; (p < n_pages) && !g_abort; ++p) {
+			g_hw->eeprom_set_page_size(eeprom, pages[p]);
+
+			for (l = 0; (l < n_lengths) && !g_abort; ++l) {
+				const size_t n_writes = bench_count_writes(
+					opt->skip, lengths[l], blocks[b],
+					pages[p]);
+				const char *result = "ok";
+				unsigned long long t;
+				unsigned long long wait;
+
+				/* New data for each run, so a write which did
+				 * not happen shows a mismatch */
+				fill_eeprom_pattern(EEPROM_PATTERN_RANDOM, seed,
+						    (n_runs++ * max_length),
+						    data_w, lengths[l]);
+
+				g_hw->eeprom_seek(eeprom, opt->skip);
+				t = get_time_us();
+
+				if (g_hw->eeprom_write(eeprom, data_w,
+						       lengths[l]) < 0)
+					result = "error";
+
+				t = get_time_us() - t;
+				wait = (t > read_us[l]) ? (t - read_us[l]) : 0;
+				g_hw->eeprom_seek(eeprom, opt->skip);
+
+				if (g_hw->eeprom_read(eeprom, data_r,
+						      lengths[l]) < 0)
+					result = "error";
+				else if (memcmp(data_r, data_w, lengths[l]))
+					result = "mismatch";
+
+				printf("write\t%lu\t%lu\t%lu\t%llu\t%.0f\t"
+				       "%zu\t%.1f\t%.1f\t%s\n", blocks[b],
+				       pages[p], lengths[l], t,
+				       (lengths[l] * 1000000.0 / (t ? t : 1)),
+				       n_writes, ((double) t / n_writes),
+				       ((double) wait / n_writes), result);
+			}
+		}
+
+		fflush(stdout);
+	}
+
+	LOG("restoring original data");
+	g_hw->eeprom_set_block_size(eeprom, safe_block);
+	g_hw->eeprom_set_page_size(eeprom, safe_page);
+	g_hw->eeprom_seek(eeprom, backup_offset);
+
+	if (g_hw->eeprom_write(eeprom, backup, backup_size) < 0) {
+		LOG("failed to restore the original data");
+		ret = -1;
+	} else {
+		g_hw->eeprom_seek(eeprom, backup_offset);
+
+		if ((g_hw->eeprom_read(eeprom, data_r, backup_size) < 0)
+		    || memcmp(data_r, backup, backup_size)) {
+			LOG("failed to verify the restored data");
+			ret = -1;
+		}
+	}
+
+	if (g_abort)
+		ret = -1;
+
+exit_free:
+	free(data_r);
+	free(data_w);
+	free(backup);
+
+	return ret;
+}
+
+/* The block size is the largest one for which reading gives the same data as
+ * with the smallest block size.  The page size is the largest one for which
+ * writing two pages of random data does not wrap around within a smaller
+ * actual page, and it is only probed up to the block size since the writes
+ * are split in blocks.  The scratch area is saved first and restored at the
+ * end with the probed values. */
+static int probe_eeprom(struct eeprom *eeprom, const struct eeprom_opt *opt)
+{
+	static const unsigned long BLOCKS[] = {
+		16, 32, 64, 96, 128, 256, 512,
+	};
+	static const size_t n_blocks = sizeof(BLOCKS) / sizeof(BLOCKS[0]);
+	static const unsigned long MIN_PAGE = 8;
+	const uint64_t seed = opt->seed ? opt->seed : (uint64_t) time(NULL);
+	unsigned long block = 0;
+	unsigned long page = 0;
+	unsigned long max_page;
+	size_t max_read;
+	size_t scratch;
+	size_t scratch_size;
+	char *backup = NULL;
+	char *data_w = NULL;
+	char *data_r = NULL;
+	char *ref = NULL;
+	size_t b;
+	int ret = 0;
+
+	max_read = min(BLOCKS[n_blocks - 1], opt->data_size);
+	ref = malloc(max_read);
+	data_r = malloc(max_read);
+
+	if ((ref == NULL) || (data_r == NULL)) {
+		LOG("failed to allocate buffers");
+		ret = -1;
+		goto exit_free;
+	}
+
+	g_hw->eeprom_set_block_size(eeprom, BLOCKS[0]);
+	g_hw->eeprom_seek(eeprom, opt->skip);
+
+	if (g_hw->eeprom_read(eeprom, ref, max_read) < 0) {
+		LOG("failed to read with %lu byte blocks", BLOCKS[0]);
+		ret = -1;
+		goto exit_free;
+	}
+
+	for (b = 0; (b < n_blocks) && (BLOCKS[b] <= max_read) && !g_abort;
+	     ++b) {
+		g_hw->eeprom_set_block_size(eeprom, BLOCKS[b]);
+		g_hw->eeprom_seek(eeprom, opt->skip);
+
+		if ((g_hw->eeprom_read(eeprom, data_r, BLOCKS[b]) < 0)
+		    || memcmp(data_r, ref, BLOCKS[b]))
+			break;
+
+		block = BLOCKS[b];
+	}
+
+	if (!block) {
+		LOG("failed to find a working I2C block size");
+		ret = -1;
+		goto exit_free;
+	}
+
+	LOG("I2C block size: %lu", block);
+	g_hw->eeprom_set_block_size(eeprom, block);
+
+	/* Largest power of 2 page size which fits twice in the area */
+	for (max_page = MIN_PAGE; ((max_page * 2) <= block); max_page *= 2);
+
+	for (;;) {
+		scratch = ((opt->skip + max_page - 1) / max_page) * max_page;
+		scratch_size = max_page * 2;
+
+		if ((scratch + scratch_size) <= (opt->skip + opt->data_size))
+			break;
+
+		if (max_page == MIN_PAGE) {
+			LOG("not enough space to probe the page size");
+			ret = -1;
+			goto exit_free;
+		}
+
+		max_page /= 2;
+	}
+
+	backup = malloc(scratch_size);
+	data_w = malloc(scratch_size);
+	free(data_r);
+	data_r = malloc(scratch_size);
+
+	if ((backup == NULL) || (data_w == NULL) || (data_r == NULL)) {
+		LOG("failed to allocate buffers");
+		ret = -1;
+		goto exit_free;
+	}
+
+	LOG("saving %zu bytes at offset %zu", scratch_size, scratch);
+	g_hw->eeprom_seek(eeprom, scratch);
+
+	if (g_hw->eeprom_read(eeprom, backup, scratch_size) < 0) {
+		LOG("failed to read the original data");
+		ret = -1;
+		goto exit_free;
+	}
+
+	for (page = max_page; (page >= MIN_PAGE) && !g_abort; page /= 2) {
+		const size_t n = page * 2;
+
+		fill_eeprom_pattern(EEPROM_PATTERN_RANDOM, (seed ^ page),
+				    scratch, data_w, n);
+		g_hw->eeprom_set_page_size(eeprom, page);
+		g_hw->eeprom_seek(eeprom, scratch);
+
+		if (g_hw->eeprom_write(eeprom, data_w, n) < 0) {
+			LOG("page size %lu: write error", page);
+			continue;
+		}
+
+		g_hw->eeprom_seek(eeprom, scratch);
+
+		if (g_hw->eeprom_read(eeprom, data_r, n) < 0) {
+			LOG("page size %lu: read error", page);
+			continue;
+		}
+
+		if (!memcmp(data_r, data_w, n))
+			break;
+
+		LOG("page size %lu: mismatch", page);
+	}
+
+	if (page < MIN_PAGE) {
+		LOG("failed to find a working page size");
+		page = MIN_PAGE;
+		ret = -1;
+	} else if (!g_abort) {
+		LOG("EEPROM page size: %lu", page);
+	}
+
+	LOG("restoring original data");
+	g_hw->eeprom_set_page_size(eeprom, page);
+	g_hw->eeprom_seek(eeprom, scratch);
+
+	if (g_hw->eeprom_write(eeprom, backup, scratch_size) < 0) {
+		LOG("failed to restore the original data");
+		ret = -1;
+	} else {
+		g_hw->eeprom_seek(eeprom, scratch);
+
+		if ((g_hw->eeprom_read(eeprom, data_r, scratch_size) < 0)
+		    || memcmp(data_r, backup, scratch_size)) {
+			LOG("failed to verify the restored data");
+			ret = -1;
+		}
+	}
+
+	if (g_abort)
+		ret = -1;
+
+	if (!ret)
+		printf("-o i2c_block_size=%lu,page_size=%lu\n", block, page);
+
+exit_free:
+	free(ref);
+	free(data_r);
+	free(data_w);
+	free(backup);
+
+	return ret;
+}
+
+/* Hash the EEPROM data as it is being read, without storing it */
+static int sum_eeprom(struct eeprom *eeprom, const char *algo_name,
+		      const char *expected, const struct eeprom_opt *opt)
+{
+	const struct digest_algo *algo = get_digest_algo(algo_name);
+	unsigned char digest[DIGEST_MAX_SIZE];
+	char digest_str[(DIGEST_MAX_SIZE * 2) + 1];
+	union digest_ctx ctx;
+	char *buffer;
+	size_t left = opt->data_size;
+	int ret = 0;
+
+	if (algo == NULL)
+		return -1;
+
+	buffer = malloc(opt->buffer_size);
+
+	if (buffer == NULL) {
+		LOG("failed to allocate buffer");
+		return -1;
+	}
+
+	algo->init(&ctx);
+	g_hw->eeprom_seek(eeprom, opt->skip);
+
+	while (left && !g_abort) {
+		const size_t n = min(left, opt->buffer_size);
+
+		if (g_hw->eeprom_read(eeprom, buffer, n) < 0) {
+			LOG("failed to read data");
+			ret = -1;
+			break;
+		}
+
+		algo->update(&ctx, buffer, n);
+		left -= n;
+		log_eeprom_progress(opt->data_size, left, "Hashing");
+	}
+
+	LOG_PRINT("\n");
+	free(buffer);
+
+	if (ret || g_abort)
+		return -1;
+
+	algo->final(&ctx, digest);
+	digest_to_str(digest, algo->size, digest_str);
+	printf("%s\n", digest_str);
+
+	if (expected != NULL) {
+		if (strcasecmp(expected, digest_str)) {
+			LOG("%s mismatch, expected %s", algo->name, expected);
+			ret = -1;
+		} else {
+			LOG("%s match", algo->name);
+		}
+	}
+
+	return ret;
+}
+
+/* Write the data at the given offset, or in EEPROM_WRITE_DIFF mode only the
+ * pages that differ from the data.  In EEPROM_WRITE_VERIFY mode, the pages
+ * are only compared and pages_written counts the ones that differ. */
+static int write_eeprom_data(struct eeprom *eeprom, size_t offset,
+			     const char *data, size_t size,
+			     const struct eeprom_opt *opt,
+			     struct eeprom_write_stats *stats)
+{
+	const size_t page_size = get_eeprom_page_size(opt);
+	char *page;
+	int ret = 0;
+
+	if (opt->write_mode == EEPROM_WRITE_ALL) {
+		g_hw->eeprom_seek(eeprom, offset);
+
+		if (g_hw->eeprom_write(eeprom, data, size) < 0)
+			return -1;
+
+		stats->pages_written += ((offset + size + page_size - 1)
+					 / page_size) - (offset / page_size);
+
+		return 0;
+	}
+
+	page = malloc(page_size);
+
+	if (page == NULL) {
+		LOG("failed to allocate page buffer");
+		return -1;
+	}
+
+	while (size && !ret) {
+		const size_t n = min((page_size - (offset % page_size)), size);
+
+		g_hw->eeprom_seek(eeprom, offset);
+
+		if (g_hw->eeprom_read(eeprom, page, n) < 0) {
+			ret = -1;
+		} else if (!memcmp(page, data, n)) {
+			stats->pages_skipped++;
+		} else {
+			stats->pages_written++;
+
+			if (opt->write_mode == EEPROM_WRITE_DIFF) {
+				g_hw->eeprom_seek(eeprom, offset);
+
+				if (g_hw->eeprom_write(eeprom, data, n) < 0)
+					ret = -1;
+			}
+		}
+
+		offset += n;
+		data += n;
+		size -= n;
+	}
+
+	free(page);
+
+	return ret;
+}
+
+/* Write the pattern over the given range with whole pages aligned on the
+ * page boundaries, a chunk of buffer_size bytes at a time.  The range ends
+ * with the data_size area, which is used to show the progress. */
+static int fill_eeprom_range(struct eeprom *eeprom, size_t offset, size_t size,
+			     enum eeprom_pattern pattern, uint64_t seed,
+			     const struct eeprom_opt *opt,
+			     struct eeprom_write_stats *stats, const char *msg)
+{
+	const size_t page_size = get_eeprom_page_size(opt);
+	const size_t chunk_size = (opt->buffer_size > page_size) ?
+		(opt->buffer_size - (opt->buffer_size % page_size)) : page_size;
+	const size_t end = opt->skip + opt->data_size;
+	char *data = malloc(chunk_size);
+	int ret = 0;
+
+	if (data == NULL) {
+		LOG("failed to allocate fill buffer");
+		return -1;
+	}
+
+	while (size && !ret && !g_abort) {
+		const size_t n = min((chunk_size - (offset % page_size)), size);
+
+		fill_eeprom_pattern(pattern, seed, offset, data, n);
+
+		if (write_eeprom_data(eeprom, offset, data, n, opt, stats))
+			ret = -1;
+
+		offset += n;
+		size -= n;
+		log_eeprom_progress(opt->data_size, (end - offset), msg);
+	}
+
+	free(data);
+
+	return ret;
+}
+
+static int pad_eeprom(struct eeprom *eeprom, size_t left,
+		      const struct eeprom_opt *opt,
+		      struct eeprom_write_stats *stats)
+{
+	const size_t offset = opt->skip + opt->data_size - left;
+
+	return fill_eeprom_range(eeprom, offset, left, EEPROM_PATTERN_BYTE, 0,
+				 opt, stats, "Padding");
+}
+
+/* The pattern is either a byte value or one of the test patterns, so the
+ * EEPROM can be erased to 0x00 or 0xFF for example. */
+static int fill_eeprom(struct eeprom *eeprom, const char *pattern_str,
+		       const struct eeprom_opt *opt)
+{
+	enum eeprom_pattern pattern;
+	struct eeprom_write_stats stats = { 0, 0 };
+	unsigned long byte;
+	uint64_t seed;
+	int ret;
+
+	if (!parse_ul(pattern_str, &byte)) {
+		if (byte > 0xFF) {
+			LOG("invalid fill byte: %s", pattern_str);
+			return -1;
+		}
+
+		pattern = EEPROM_PATTERN_BYTE;
+		seed = byte;
+	} else if (!parse_eeprom_pattern(pattern_str, &pattern)) {
+		seed = opt->seed ? opt->seed : (uint64_t) time(NULL);
+
+		if (pattern == EEPROM_PATTERN_RANDOM)
+			LOG("seed: %llu", (unsigned long long) seed);
+	} else {
+		LOG("invalid fill pattern: %s", pattern_str);
+		return -1;
+	}
+
+	ret = fill_eeprom_range(eeprom, opt->skip, opt->data_size, pattern,
+				seed, opt, &stats, "Filling");
+	LOG_PRINT("\n");
+
+	if (opt->write_mode == EEPROM_WRITE_DIFF)
+		LOG("%zu pages written, %zu pages skipped",
+		    stats.pages_written, stats.pages_skipped);
+
+	return ret;
+}
+
+static int rw_file_eeprom(struct eeprom *eeprom, int fd, int write_file,
+			  const struct eeprom_opt *opt)
+{
+	const size_t buffer_size = opt->buffer_size;
+	const int verify = (opt->write_mode == EEPROM_WRITE_VERIFY);
+	const char *msg = write_file ? "Reading" : verify ? "Verifying" :
+		"Writing";
+	char *buffer = malloc(buffer_size);
+	struct eeprom_write_stats stats = { 0, 0 };
+	size_t left;
+	int ret;
+
+	left = opt->data_size;
+
+	if (buffer == NULL) {
+		LOG("failed to allocate buffer");
+		return -1;
+	}
+
+	g_hw->eeprom_seek(eeprom, opt->skip);
+	ret = 0;
+
+	while (left && !ret && !g_abort) {
+		const size_t rwsz =
+			(left > buffer_size) ? buffer_size : left;
+
+		if (write_file) {
+			log_eeprom_progress(opt->data_size, left - rwsz, msg);
+
+			if (g_hw->eeprom_read(eeprom, buffer, rwsz) < 0)
+				ret = -1;
+			else if (write(fd, buffer, rwsz) < 0)
+				ret = -1;
+
+			left -= rwsz;
+		} else {
+			const ssize_t rdsz = read(fd, buffer, rwsz);
+
+			if (rdsz >= 0)
+				log_eeprom_progress(opt->data_size,
+						    (left - rdsz), msg);
+
+			if (rdsz < 0) {
+				ret = -1;
+			} else if (write_eeprom_data(
+					   eeprom,
+					   (opt->skip + opt->data_size - left),
+					   buffer, rdsz, opt, &stats)) {
+				ret = -1;
+			} else if ((size_t) rdsz == rwsz) {
+				left -= rwsz;
+			} else {
+				if (opt->zero_padding) {
+					LOG_PRINT("\n");
+					left -= rdsz;
+					ret = pad_eeprom(eeprom, left, opt,
+							 &stats);
+				}
+
+				left = 0;
+			}
+		}
+	}
+
+	LOG_PRINT("\n");
+	free(buffer);
+
+	if (verify) {
+		LOG("%zu pages identical, %zu pages different",
+		    stats.pages_skipped, stats.pages_written);
+
+		if (stats.pages_written)
+			ret = -1;
+	} else if (opt->write_mode == EEPROM_WRITE_DIFF) {
+		LOG("%zu pages written, %zu pages skipped",
+		    stats.pages_written, stats.pages_skipped);
+	}
+
+	return ret;
+}
+
+/* Transfer the data directly between the EEPROM and the file mapped in
+ * memory, in chunks aligned with the EEPROM pages. */
+static int map_file_eeprom(struct eeprom *eeprom, int fd, int write_file,
+			   const struct eeprom_opt *opt)
+{
+	const int verify = (opt->write_mode == EEPROM_WRITE_VERIFY);
+	const char *msg = write_file ? "Reading" : verify ? "Verifying" :
+		"Writing";
+	const size_t page_size = get_eeprom_page_size(opt);
+	const size_t chunk_size = (opt->buffer_size > page_size) ?
+		(opt->buffer_size - (opt->buffer_size % page_size)) : page_size;
+	const char *journal = opt->journal[0] ? opt->journal : NULL;
+	struct eeprom_write_stats stats = { 0, 0 };
+	char image_hash[(DIGEST_MAX_SIZE * 2) + 1];
+	size_t map_size;
+	char *map;
+	size_t done = 0;
+	int ret = 0;
+
+	if (write_file) {
+		map_size = opt->data_size;
+
+		if (ftruncate(fd, map_size) < 0) {
+			LOG("failed to set the file size");
+			return -1;
+		}
+	} else {
+		struct stat st;
+
+		if (fstat(fd, &st) < 0) {
+			LOG("failed to get the file size");
+			return -1;
+		}
+
+		map_size = min((size_t) st.st_size, opt->data_size);
+	}
+
+	if (map_size) {
+		const int prot = write_file ? (PROT_READ | PROT_WRITE) :
+			PROT_READ;
+
+		map = mmap(NULL, map_size, prot, MAP_SHARED, fd, 0);
+
+		if (map == MAP_FAILED) {
+			LOG("failed to map the file, using buffered I/O");
+			return rw_file_eeprom(eeprom, fd, write_file, opt);
+		}
+	} else {
+		map = NULL;
+	}
+
+	if (write_file)
+		g_hw->eeprom_seek(eeprom, opt->skip);
+
+	if ((journal != NULL) && map_size) {
+		const struct digest_algo *algo = get_digest_algo("sha256");
+		unsigned char digest[DIGEST_MAX_SIZE];
+		union digest_ctx ctx;
+
+		algo->init(&ctx);
+		algo->update(&ctx, map, map_size);
+		algo->final(&ctx, digest);
+		digest_to_str(digest, algo->size, image_hash);
+
+		if (opt->resume)
+			done = load_eeprom_journal(eeprom, journal, image_hash,
+						   map, map_size, opt);
+	}
+
+	while ((done < map_size) && !ret && !g_abort) {
+		const size_t offset = opt->skip + done;
+		const size_t n = min((chunk_size - (offset % chunk_size)),
+				     (map_size - done));
+
+		if (write_file)
+			ret = g_hw->eeprom_read(eeprom, &map[done], n);
+		else
+			ret = write_eeprom_data(eeprom, offset, &map[done], n,
+						opt, &stats);
+
+		if (ret < 0)
+			ret = -1;
+		else
+			done += n;
+
+		if (!ret && (journal != NULL)
+		    && save_eeprom_journal(journal, image_hash, opt, map_size,
+					   done)) {
+			LOG_PRINT("\n");
+			LOG("failed to save the journal (%s)", journal);
+			ret = -1;
+		}
+
+		log_eeprom_progress(opt->data_size, (opt->data_size - done),
+				    msg);
+	}
+
+	if (map != NULL)
+		munmap(map, map_size);
+
+	if (g_abort)
+		ret = -1;
+
+	if (journal != NULL) {
+		if (!ret && !g_abort) {
+			unlink(journal);
+		} else if (done) {
+			LOG_PRINT("\n");
+			LOG("stopped after %zu bytes, use the resume option to "
+			    "continue", done);
+		}
+	}
+
+	if (!ret && !g_abort && (map_size < opt->data_size)
+	    && opt->zero_padding) {
+		LOG_PRINT("\n");
+		ret = pad_eeprom(eeprom, (opt->data_size - map_size), opt,
+				 &stats);
+	}
+
+	LOG_PRINT("\n");
+
+	if (verify) {
+		LOG("%zu pages identical, %zu pages different",
+		    stats.pages_skipped, stats.pages_written);
+
+		if (stats.pages_written)
+			ret = -1;
+	} else if (opt->write_mode == EEPROM_WRITE_DIFF) {
+		LOG("%zu pages written, %zu pages skipped",
+		    stats.pages_written, stats.pages_skipped);
+	}
+
+	return ret;
+}
+
+/* -- display data -- */
+
+/* Display data header found at the beginning of the display EEPROM, with
+ * all the numbers stored as big-endian.  The magic number and the version
+ * are followed by the info part, from the panel id to the waveform target,
+ * and the CRC of the info part. */
+#define DISP_DATA_MAGIC 0x46574C50
+#define DISP_DATA_VERSION 1
+#define DISP_DATA_STR_LEN 64
+#define DISP_DATA_INFO_OFFSET 6
+#define DISP_DATA_INFO_SIZE 284
+#define DISP_DATA_CRC_OFFSET (DISP_DATA_INFO_OFFSET + DISP_DATA_INFO_SIZE)
+
+enum disp_data_type {
+	DISP_DATA_UINT,
+	DISP_DATA_INT,
+	DISP_DATA_STR,
+	DISP_DATA_HEX,
+};
+
+static const struct disp_data_field {
+	const char *name;
+	size_t offset;
+	size_t size;
+	enum disp_data_type type;
+} disp_data_fields[] = {
+	{ "panel_id", 6, DISP_DATA_STR_LEN, DISP_DATA_STR },
+	{ "panel_type", 70, DISP_DATA_STR_LEN, DISP_DATA_STR },
+	{ "vcom", 134, 4, DISP_DATA_INT },
+	{ "waveform_md5", 138, 16, DISP_DATA_HEX },
+	{ "waveform_full_length", 154, 4, DISP_DATA_UINT },
+	{ "waveform_lzss_length", 158, 4, DISP_DATA_UINT },
+	{ "waveform_id", 162, DISP_DATA_STR_LEN, DISP_DATA_STR },
+	{ "waveform_target", 226, DISP_DATA_STR_LEN, DISP_DATA_STR },
+	{ NULL },
+};
+
+static unsigned long get_disp_data_be(const unsigned char *data, size_t size)
+{
+	unsigned long value = 0;
+
+	while (size--)
+		value = (value << 8) | *data++;
+
+	return value;
+}
+
+static void set_disp_data_be(unsigned char *data, size_t size,
+			     unsigned long value)
+{
+	while (size--) {
+		data[size] = value & 0xFF;
+		value >>= 8;
+	}
+}
+
+/* CRC-16/CCITT with 0xFFFF as initial value */
+static uint16_t disp_data_crc16(const unsigned char *data, size_t size)
+{
+	uint16_t crc = 0xFFFF;
+	int bit;
+
+	while (size--) {
+		crc ^= *data++ << 8;
+
+		for (bit = 0; bit < 8; ++bit)
+			crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) :
+				(crc << 1);
+	}
+
+	return crc;
+}
+
+static int read_disp_data(struct eeprom *eeprom,
+			  const struct eeprom_opt *opt, size_t offset,
+			  unsigned char *data, size_t size)
+{
+	g_hw->eeprom_seek(eeprom, (opt->skip + offset));
+
+	if (g_hw->eeprom_read(eeprom, (char *) data, size) < 0) {
+		LOG("failed to read display data");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int check_disp_data(struct eeprom *eeprom,
+			   const struct eeprom_opt *opt)
+{
+	unsigned char vermagic[6];
+	unsigned long magic;
+	unsigned long version;
+
+	if (read_disp_data(eeprom, opt, 0, vermagic, sizeof(vermagic)))
+		return -1;
+
+	magic = get_disp_data_be(vermagic, 4);
+	version = get_disp_data_be(&vermagic[4], 2);
+
+	if (magic != DISP_DATA_MAGIC) {
+		LOG("no display data found (magic: 0x%08lX)", magic);
+		return -1;
+	}
+
+	if (version != DISP_DATA_VERSION) {
+		LOG("unsupported display data version: %lu", version);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void print_disp_data_field(const struct disp_data_field *field,
+				  const unsigned char *data, int with_name)
+{
+	char hex[(DIGEST_MAX_SIZE * 2) + 1];
+
+	if (with_name)
+		printf("%s: ", field->name);
+
+	switch (field->type) {
+	case DISP_DATA_UINT:
+		printf("%lu\n", get_disp_data_be(data, field->size));
+		break;
+
+	case DISP_DATA_INT:
+		printf("%ld\n", (long) (int32_t) get_disp_data_be(
+			       data, field->size));
+		break;
+
+	case DISP_DATA_STR:
+		printf("%.*s\n", (int) field->size, (const char *) data);
+		break;
+
+	case DISP_DATA_HEX:
+		digest_to_str(data, field->size, hex);
+		printf("%s\n", hex);
+		break;
+	}
+}
+
+static int parse_disp_data_field(const struct disp_data_field *field,
+				 const char *str, unsigned char *data)
+{
+	const long long int_max = (1LL << (field->size * 8 - 1)) - 1;
+	unsigned long value;
+	long long int_value;
+	char *end;
+	size_t i;
+
+	switch (field->type) {
+	case DISP_DATA_UINT:
+		if (parse_ul(str, &value)
+		    || (value >> (field->size * 8 - 1) >> 1))
+			return -1;
+
+		set_disp_data_be(data, field->size, value);
+		break;
+
+	case DISP_DATA_INT:
+		errno = 0;
+		int_value = strtoll(str, &end, 0);
+
+		if (errno || (end == str) || (*end != '\0')
+		    || (int_value > int_max) || (int_value < (-int_max - 1)))
+			return -1;
+
+		set_disp_data_be(data, field->size, (unsigned long) int_value);
+		break;
+
+	case DISP_DATA_STR:
+		if (strlen(str) >= field->size)
+			return -1;
+
+		memset(data, 0, field->size);
+		memcpy(data, str, strlen(str));
+		break;
+
+	case DISP_DATA_HEX:
+		if (strlen(str) != (field->size * 2))
+			return -1;
+
+		for (i = 0; i < field->size; ++i) {
+			char byte_str[3] = { str[i * 2], str[i * 2 + 1], '\0' };
+
+			data[i] = strtoul(byte_str, &end, 16);
+
+			if (*end != '\0')
+				return -1;
+		}
+		break;
+	}
+
+	return 0;
+}
+
+static const struct disp_data_field *get_disp_data_field(const char *name)
+{
+	const struct disp_data_field *field;
+
+	for (field = disp_data_fields; field->name != NULL; ++field)
+		if (!strcmp(field->name, name))
+			return field;
+
+	LOG("invalid display data field: %s", name);
+
+	return NULL;
+}
+
+/* Only read the bytes of the field, or the whole header with no field */
+static int get_disp_data(struct eeprom *eeprom, const char *name,
+			 const struct eeprom_opt *opt)
+{
+	unsigned char info[DISP_DATA_CRC_OFFSET];
+	const struct disp_data_field *field;
+
+	if (check_disp_data(eeprom, opt))
+		return -1;
+
+	if (name == NULL) {
+		if (read_disp_data(eeprom, opt, 0, info, sizeof(info)))
+			return -1;
+
+		for (field = disp_data_fields; field->name != NULL; ++field)
+			print_disp_data_field(field, &info[field->offset], 1);
+
+		return 0;
+	}
+
+	field = get_disp_data_field(name);
+
+	if ((field == NULL)
+	    || read_disp_data(eeprom, opt, field->offset, info, field->size))
+		return -1;
+
+	print_disp_data_field(field, info, 0);
+
+	return 0;
+}
+
+/* Only write the bytes of the field and the CRC of the info part */
+static int set_disp_data(struct eeprom *eeprom, const char *name,
+			 const char *value, const struct eeprom_opt *opt)
+{
+	unsigned char data[DISP_DATA_CRC_OFFSET + 2];
+	const struct disp_data_field *field = get_disp_data_field(name);
+	struct eeprom_write_stats stats = { 0, 0 };
+	unsigned char *crc = &data[DISP_DATA_CRC_OFFSET];
+	const unsigned char *info = &data[DISP_DATA_INFO_OFFSET];
+
+	if ((field == NULL) || check_disp_data(eeprom, opt))
+		return -1;
+
+	if (read_disp_data(eeprom, opt, 0, data, sizeof(data)))
+		return -1;
+
+	if (get_disp_data_be(crc, 2)
+	    != disp_data_crc16(info, DISP_DATA_INFO_SIZE)) {
+		if (!opt->force) {
+			LOG("invalid display data CRC, use force to fix it");
+			return -1;
+		}
+
+		LOG("Warning: invalid display data CRC, fixing it");
+	}
+
+	if (parse_disp_data_field(field, value, &data[field->offset])) {
+		LOG("invalid value for %s: %s", field->name, value);
+		return -1;
+	}
+
+	set_disp_data_be(crc, 2, disp_data_crc16(info, DISP_DATA_INFO_SIZE));
+
+	if (write_eeprom_data(eeprom, (opt->skip + field->offset),
+			      (const char *) &data[field->offset],
+			      field->size, opt, &stats)
+	    || write_eeprom_data(eeprom, (opt->skip + DISP_DATA_CRC_OFFSET),
+				 (const char *) crc, 2, opt, &stats)) {
+		LOG("failed to write display data");
+		return -1;
+	}
+
+	LOG("%s set to %s", field->name, value);
+
+	return 0;
+}
+
+/* -- resumable transfers -- */
+
+/* The journal is a small text file rewritten after each chunk, with the
+ * SHA-256 of the image, the EEPROM area and the number of bytes written
+ * so far, which always end on an EEPROM page boundary or at the end of the
+ * image. */
+static int save_eeprom_journal(const char *path, const char *image_hash,
+			       const struct eeprom_opt *opt, size_t size,
+			       size_t offset)
+{
+	char tmp_path[PATH_MAX + 4];
+	FILE *f;
+	int ret = 0;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	f = fopen(tmp_path, "w");
+
+	if (f == NULL)
+		return -1;
+
+	if (fprintf(f, "image=%s\nskip=%zu\nsize=%zu\noffset=%zu\n",
+		    image_hash, opt->skip, size, offset) < 0)
+		ret = -1;
+
+	if (fclose(f) || ret) {
+		unlink(tmp_path);
+		return -1;
+	}
+
+	/* The previous journal is only replaced once the new one is there */
+	return rename(tmp_path, path);
+}
+
+/* Return the offset to resume from, or 0 when the journal is not there,
+ * does not match the image or the data already written is different. */
+static size_t load_eeprom_journal(struct eeprom *eeprom, const char *path,
+				  const char *image_hash, const char *image,
+				  size_t size, const struct eeprom_opt *opt)
+{
+	const struct digest_algo *algo = get_digest_algo("xxh64");
+	char hash[(DIGEST_MAX_SIZE * 2) + 1];
+	unsigned char image_digest[DIGEST_MAX_SIZE];
+	unsigned char eeprom_digest[DIGEST_MAX_SIZE];
+	union digest_ctx ctx;
+	size_t j_skip;
+	size_t j_size;
+	size_t offset;
+	size_t done;
+	char *buffer;
+	FILE *f;
+	int n;
+
+	f = fopen(path, "r");
+
+	if (f == NULL) {
+		LOG("no journal, starting from the beginning");
+		return 0;
+	}
+
+	n = fscanf(f, "image=%64s skip=%zu size=%zu offset=%zu", hash,
+		   &j_skip, &j_size, &offset);
+	fclose(f);
+
+	if ((n != 4) || strcmp(hash, image_hash) || (j_skip != opt->skip)
+	    || (j_size != size) || (offset > size)) {
+		LOG("journal does not match, starting from the beginning");
+		return 0;
+	}
+
+	buffer = malloc(opt->buffer_size);
+
+	if (buffer == NULL) {
+		LOG("failed to allocate buffer");
+		return 0;
+	}
+
+	/* Quick check of the data already written, as it may have been
+	 * changed since the journal was saved. */
+	algo->init(&ctx);
+	g_hw->eeprom_seek(eeprom, opt->skip);
+
+	for (done = 0; (done < offset) && !g_abort; ) {
+		const size_t n = min(opt->buffer_size, (offset - done));
+
+		if (g_hw->eeprom_read(eeprom, buffer, n) < 0)
+			break;
+
+		algo->update(&ctx, buffer, n);
+		done += n;
+		log_eeprom_progress(offset, (offset - done), "Checking");
+	}
+
+	LOG_PRINT("\n");
+	free(buffer);
+
+	if (done < offset) {
+		LOG("failed to check the data, starting from the beginning");
+		return 0;
+	}
+
+	algo->final(&ctx, eeprom_digest);
+	algo->init(&ctx);
+	algo->update(&ctx, image, offset);
+	algo->final(&ctx, image_digest);
+
+	if (memcmp(eeprom_digest, image_digest, algo->size)) {
+		LOG("EEPROM data changed, starting from the beginning");
+		return 0;
+	}
+
+	LOG("resuming from offset %zu", offset);
+
+	return offset;
+}
+
+/* -- image cache -- */
+
+/* The cache entries are named after the SHA-256 of the display data header
+ * found at skip along with the EEPROM area, so the data is assumed to be
+ * the same as long as the header is the same.  Only EEPROMs with a valid
+ * header can use the cache. */
+static int get_eeprom_cache_path(struct eeprom *eeprom,
+				 const struct eeprom_opt *opt, char *path)
+{
+	const struct digest_algo *algo = get_digest_algo("sha256");
+	unsigned char header[DISP_DATA_CRC_OFFSET + 2];
+	const unsigned char *info = &header[DISP_DATA_INFO_OFFSET];
+	unsigned char digest[DIGEST_MAX_SIZE];
+	char hash[(DIGEST_MAX_SIZE * 2) + 1];
+	union digest_ctx ctx;
+
+	if ((opt->data_size < sizeof(header))
+	    || read_disp_data(eeprom, opt, 0, header, sizeof(header)))
+		return -1;
+
+	if ((get_disp_data_be(header, 4) != DISP_DATA_MAGIC)
+	    || (get_disp_data_be(&header[DISP_DATA_CRC_OFFSET], 2)
+		!= disp_data_crc16(info, DISP_DATA_INFO_SIZE)))
+		return -1;
+
+	algo->init(&ctx);
+	algo->update(&ctx, (const char *) header, sizeof(header));
+	algo->final(&ctx, digest);
+	digest_to_str(digest, algo->size, hash);
+	snprintf(path, PATH_MAX, "%s/%s-%zx-%zx.bin", opt->cache, hash,
+		 opt->skip, opt->data_size);
+
+	return 0;
+}
+
+/* Copy the cache entry to the file, or return -1 if there is no entry of
+ * the expected size. */
+static int copy_eeprom_cache(const char *path, int fd, size_t size)
+{
+	char buffer[4096];
+	struct stat st;
+	int cache_fd;
+	int ret = 0;
+
+	cache_fd = open(path, O_RDONLY);
+
+	if (cache_fd < 0)
+		return -1;
+
+	if (fstat(cache_fd, &st) || ((size_t) st.st_size != size)) {
+		close(cache_fd);
+		return -1;
+	}
+
+	while (size && !ret) {
+		const ssize_t n = read_full(cache_fd, buffer,
+					    min(sizeof(buffer), size));
+
+		if ((n <= 0) || (write_full(fd, buffer, n) < 0)) {
+			LOG("failed to copy the cache entry");
+			ret = -2;
+		} else {
+			size -= n;
+		}
+	}
+
+	close(cache_fd);
+
+	return ret;
+}
+
+/* Read the EEPROM into a new cache entry, or the first src_size bytes of
+ * src_fd when eeprom is NULL, and only replace the previous entry once the
+ * new one is complete. */
+static int save_eeprom_cache(const char *path, struct eeprom *eeprom,
+			     int src_fd, size_t src_size,
+			     const struct eeprom_opt *opt)
+{
+	char tmp_path[PATH_MAX + 4];
+	char buffer[4096];
+	size_t done = 0;
+	int fd;
+	int ret = 0;
+
+	if ((mkdir(opt->cache, 0755) < 0) && (errno != EEXIST)) {
+		LOG("failed to create the cache directory");
+		return -1;
+	}
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	fd = open(tmp_path, (O_RDWR | O_CREAT | O_TRUNC), 0644);
+
+	if (fd < 0) {
+		LOG("failed to create the cache entry");
+		return -1;
+	}
+
+	if (eeprom != NULL) {
+		ret = map_file_eeprom(eeprom, fd, 1, opt);
+	} else {
+		while ((done < src_size) && !ret) {
+			const ssize_t n = pread(
+				src_fd, buffer,
+				min(sizeof(buffer), (src_size - done)), done);
+
+			if ((n <= 0) || (write_full(fd, buffer, n) < 0))
+				ret = -1;
+			else
+				done += n;
+		}
+
+		/* The rest of the EEPROM area was zero-padded */
+		if (!ret && ftruncate(fd, opt->data_size))
+			ret = -1;
+	}
+
+	if (close(fd) || ret || g_abort
+	    || (rename(tmp_path, path) < 0)) {
+		LOG("failed to save the cache entry");
+		unlink(tmp_path);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Copy the cache entry when there is one for the header currently in the
+ * EEPROM, otherwise read the EEPROM into a new entry and copy it. */
+static int cache_file_eeprom(struct eeprom *eeprom, int fd, int is_reg,
+			     const struct eeprom_opt *opt)
+{
+	char path[PATH_MAX];
+	int ret;
+
+	if (get_eeprom_cache_path(eeprom, opt, path)) {
+		LOG("no valid display data header, not using the cache");
+
+		return is_reg ? map_file_eeprom(eeprom, fd, 1, opt) :
+			rw_file_eeprom(eeprom, fd, 1, opt);
+	}
+
+	ret = copy_eeprom_cache(path, fd, opt->data_size);
+
+	if (!ret) {
+		LOG("cache hit: %s", path);
+		return 0;
+	}
+
+	if (ret < -1)
+		return -1;
+
+	LOG("cache miss: %s", path);
+
+	if (save_eeprom_cache(path, eeprom, -1, 0, opt))
+		return -1;
+
+	return copy_eeprom_cache(path, fd, opt->data_size);
+}
+
+/* After writing a regular file with its whole EEPROM area, it becomes the
+ * cache entry for the new header.  Otherwise the entry is removed as the
+ * contents of the EEPROM are not known without reading them all. */
+static int refresh_eeprom_cache(struct eeprom *eeprom, int fd, int is_reg,
+				const struct eeprom_opt *opt)
+{
+	char path[PATH_MAX];
+	struct stat st;
+
+	if (get_eeprom_cache_path(eeprom, opt, path))
+		return 0;
+
+	if (is_reg && !fstat(fd, &st)
+	    && (((size_t) st.st_size >= opt->data_size) || opt->zero_padding)) {
+		const size_t size = min((size_t) st.st_size, opt->data_size);
+
+		if (save_eeprom_cache(path, NULL, fd, size, opt))
+			return -1;
+
+		LOG("cache updated: %s", path);
+	} else if (!unlink(path)) {
+		LOG("cache entry removed: %s", path);
+	}
+
+	return 0;
+}
+
+/* -- multiple ranges -- */
+
+static int compare_eeprom_range(const void *a, const void *b)
+{
+	const struct eeprom_range *x = a;
+	const struct eeprom_range *y = b;
+
+	return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+/* Sort the ranges and merge the ones which overlap or are adjacent.  When
+ * reading, the ranges are first extended to whole pages so the ranges
+ * sharing a page are read in a single transfer. */
+static size_t merge_eeprom_ranges(const struct eeprom_opt *opt,
+				  int write_file, size_t esize,
+				  struct eeprom_range *merged)
+{
+	const size_t page_size = get_eeprom_page_size(opt);
+	size_t n = 0;
+	size_t i;
+
+	memcpy(merged, opt->ranges, (opt->n_ranges * sizeof(*merged)));
+	qsort(merged, opt->n_ranges, sizeof(*merged), compare_eeprom_range);
+
+	for (i = 0; i < opt->n_ranges; ++i) {
+		struct eeprom_range *prev = n ? &merged[n - 1] : NULL;
+		size_t start = merged[i].offset;
+		size_t end = start + merged[i].size;
+
+		if (write_file) {
+			start -= start % page_size;
+			end = min((end + page_size - 1) / page_size * page_size,
+				  esize);
+		}
+
+		if ((prev != NULL) && (start <= (prev->offset + prev->size))) {
+			prev->size = max(end, (prev->offset + prev->size))
+				- prev->offset;
+		} else {
+			merged[n].offset = start;
+			merged[n].size = end - start;
+			++n;
+		}
+	}
+
+	return n;
+}
+
+/* Transfer each range between the EEPROM and the same offsets in the file
+ * mapped in memory, so the file is always an image of the whole EEPROM. */
+static int ranges_file_eeprom(struct eeprom *eeprom, int fd, int write_file,
+			      size_t esize, const struct eeprom_opt *opt)
+{
+	const int verify = (opt->write_mode == EEPROM_WRITE_VERIFY);
+	const char *msg = write_file ? "Reading" : verify ? "Verifying" :
+		"Writing";
+	struct eeprom_range merged[EEPROM_RANGES_MAX];
+	struct eeprom_write_stats stats = { 0, 0 };
+	const size_t n_ranges = merge_eeprom_ranges(opt, write_file, esize,
+						    merged);
+	const size_t end = merged[n_ranges - 1].offset
+		+ merged[n_ranges - 1].size;
+	struct stat st;
+	size_t total = 0;
+	size_t done = 0;
+	size_t map_size;
+	char *map;
+	size_t i;
+	int ret = 0;
+
+	if (fstat(fd, &st) < 0) {
+		LOG("failed to get the file size");
+		return -1;
+	}
+
+	map_size = st.st_size;
+
+	if (write_file && (map_size < end)) {
+		map_size = end;
+
+		if (ftruncate(fd, map_size) < 0) {
+			LOG("failed to set the file size");
+			return -1;
+		}
+	} else if (map_size < end) {
+		LOG("file too small for the ranges (%zu < %zu)", map_size, end);
+		return -1;
+	}
+
+	map = mmap(NULL, map_size, (write_file ? (PROT_READ | PROT_WRITE) :
+				    PROT_READ), MAP_SHARED, fd, 0);
+
+	if (map == MAP_FAILED) {
+		LOG("failed to map the file");
+		return -1;
+	}
+
+	for (i = 0; i < n_ranges; ++i)
+		total += merged[i].size;
+
+	for (i = 0; (i < n_ranges) && !ret && !g_abort; ++i) {
+		size_t offset = merged[i].offset;
+		size_t left = merged[i].size;
+
+		if (i)
+			LOG_PRINT("\n");
+
+		LOG("range 0x%04zX-0x%04zX", offset, (offset + left - 1));
+
+		if (write_file)
+			g_hw->eeprom_seek(eeprom, offset);
+
+		while (left && !ret && !g_abort) {
+			const size_t n = min(opt->buffer_size, left);
+
+			if (write_file)
+				ret = g_hw->eeprom_read(eeprom, &map[offset],
+							n);
+			else
+				ret = write_eeprom_data(eeprom, offset,
+							&map[offset], n, opt,
+							&stats);
+
+			if (ret < 0)
+				ret = -1;
+
+			offset += n;
+			left -= n;
+			done += n;
+			log_eeprom_progress(total, (total - done), msg);
+		}
+	}
+
+	munmap(map, map_size);
+	LOG_PRINT("\n");
+
+	if (verify) {
+		LOG("%zu pages identical, %zu pages different",
+		    stats.pages_skipped, stats.pages_written);
+
+		if (stats.pages_written)
+			ret = -1;
+	} else if (opt->write_mode == EEPROM_WRITE_DIFF) {
+		LOG("%zu pages written, %zu pages skipped",
+		    stats.pages_written, stats.pages_skipped);
+	}
+
+	if (g_abort)
+		ret = -1;
+
+	return ret;
+}
+
+/* Each item is OFFSET+SIZE, with items separated by `:' */
+static int parse_eeprom_ranges(const char *str, struct eeprom_opt *eopt)
+{
+	const size_t str_size = strlen(str) + 1;
+	char *buf = malloc(str_size);
+	char *it = buf;
+	char *item;
+	int ret = 0;
+
+	assert(buf != NULL);
+	memcpy(buf, str, str_size);
+
+	while (!ret && ((item = strsep(&it, ":")) != NULL)) {
+		char *size_str = strchr(item, '+');
+		unsigned long offset;
+		unsigned long size;
+
+		if (size_str != NULL)
+			*size_str++ = '\0';
+
+		if ((size_str == NULL) || parse_ul(item, &offset)
+		    || parse_ul(size_str, &size))
+			ret = -1;
+		else
+			ret = add_eeprom_range(eopt, offset, size);
+	}
+
+	free(buf);
+
+	return ret;
+}
+
+/* Each line is OFFSET SIZE [NAME], text following a `#' is ignored */
+static int load_eeprom_layout(const char *path, struct eeprom_opt *eopt)
+{
+	FILE *f = fopen(path, "r");
+	char *line = NULL;
+	size_t line_size = 0;
+	unsigned line_no = 0;
+	int ret = 0;
+
+	if (f == NULL) {
+		LOG("failed to open layout file (%s)", path);
+		return -1;
+	}
+
+	while (!ret && (getline(&line, &line_size, f) >= 0)) {
+		char *args[3];
+		unsigned long offset;
+		unsigned long size;
+		int n;
+
+		++line_no;
+		n = split_args(line, args, 3);
+
+		if (!n)
+			continue;
+
+		if ((n < 2) || parse_ul(args[0], &offset)
+		    || parse_ul(args[1], &size)) {
+			LOG("%s:%u: invalid range", path, line_no);
+			ret = -1;
+		} else {
+			ret = add_eeprom_range(eopt, offset, size);
+		}
+	}
+
+	free(line);
+	fclose(f);
+
+	return ret;
+}
+
+static int add_eeprom_range(struct eeprom_opt *eopt, unsigned long offset,
+			    unsigned long size)
+{
+	if (!size || (eopt->n_ranges == EEPROM_RANGES_MAX)) {
+		LOG("invalid range or too many ranges");
+		return -1;
+	}
+
+	eopt->ranges[eopt->n_ranges].offset = offset;
+	eopt->ranges[eopt->n_ranges].size = size;
+	eopt->n_ranges++;
+
+	return 0;
+}
+
+/* -- compressed files -- */
+
+/* File used by the pipelined transfers, either accessed directly or
+ * through a gzip stream which is compressed or decompressed on the fly.
+ * When dumping the EEPROM, the data may also be written as a hexdump. */
+struct eeprom_file {
+	int fd;
+	int write_file;
+	enum eeprom_compress compress;
+	z_stream z;
+	char *zbuf;
+	size_t zbuf_size;
+	int z_end;
+	char *text;
+	size_t offset;
+	char line[16];
+	size_t line_len;
+	int wake_fd;
+};
+
+static int eeprom_file_init(struct eeprom_file *f, int fd, int write_file,
+			    const struct eeprom_opt *opt, size_t zbuf_size)
+{
+	const enum eeprom_compress compress = opt->compress;
+	int stat;
+
+	f->fd = fd;
+	f->write_file = write_file;
+	f->compress = compress;
+	f->zbuf = NULL;
+	f->zbuf_size = zbuf_size;
+	f->z_end = 0;
+	f->text = NULL;
+	f->offset = opt->skip;
+	f->line_len = 0;
+	f->wake_fd = -1;
+
+	if (opt->hexdump) {
+		f->text = malloc(((zbuf_size / 16) + 1) * HEX_LINE_SIZE);
+
+		if (f->text == NULL)
+			return -1;
+	}
+
+	if (compress == EEPROM_COMPRESS_NONE)
+		return 0;
+
+	f->zbuf = malloc(zbuf_size);
+
+	if (f->zbuf == NULL) {
+		free(f->text);
+		return -1;
+	}
+
+	memset(&f->z, 0, sizeof(f->z));
+
+	if (write_file) {
+		/* Z_RLE only looks for runs of identical bytes, which is much
+		 * faster and still very efficient with the padding. */
+		const int strategy = (compress == EEPROM_COMPRESS_RLE) ?
+			Z_RLE : Z_DEFAULT_STRATEGY;
+
+		/* 16 is added to the window bits to write a gzip header */
+		stat = deflateInit2(&f->z, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+				    (15 + 16), 8, strategy);
+		f->z.next_out = (Bytef *) f->zbuf;
+		f->z.avail_out = f->zbuf_size;
+	} else {
+		/* 32 is added to accept both gzip and zlib headers */
+		stat = inflateInit2(&f->z, (15 + 32));
+	}
+
+	if (stat != Z_OK) {
+		free(f->zbuf);
+		free(f->text);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void eeprom_file_free(struct eeprom_file *f)
+{
+	free(f->text);
+
+	if (f->zbuf == NULL)
+		return;
+
+	if (f->write_file)
+		deflateEnd(&f->z);
+	else
+		inflateEnd(&f->z);
+
+	free(f->zbuf);
+}
+
+/* Same as read_full(), but when wake_fd is set the reads are stopped as
+ * soon as it becomes readable or g_abort is set, with -1 returned and errno
+ * set to ECANCELED, so a pipe with no more data does not block the thread
+ * forever. */
+static ssize_t eeprom_file_read_fd(struct eeprom_file *f, char *data,
+				   size_t size)
+{
+	size_t done = 0;
+
+	if (f->wake_fd < 0)
+		return read_full(f->fd, data, size);
+
+	while (done < size) {
+		struct pollfd fds[2] = {
+			{ .fd = f->fd, .events = POLLIN },
+			{ .fd = f->wake_fd, .events = POLLIN },
+		};
+		ssize_t n;
+		int stat;
+
+		stat = poll(fds, 2, 100);
+
+		if ((stat < 0) && (errno != EINTR))
+			return -1;
+
+		if (g_abort || fds[1].revents) {
+			errno = ECANCELED;
+			return -1;
+		}
+
+		if (stat <= 0)
+			continue;
+
+		n = read(f->fd, &data[done], (size - done));
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		if (!n)
+			break;
+
+		done += n;
+	}
+
+	return done;
+}
+
+/* Fill the data buffer completely unless the end of the file is reached,
+ * and return the number of bytes read or -1 on error. */
+static ssize_t eeprom_file_read(struct eeprom_file *f, char *data,
+				size_t size)
+{
+	if (f->compress == EEPROM_COMPRESS_NONE)
+		return eeprom_file_read_fd(f, data, size);
+
+	f->z.next_out = (Bytef *) data;
+	f->z.avail_out = size;
+
+	while (f->z.avail_out && !f->z_end) {
+		int stat;
+
+		if (!f->z.avail_in) {
+			const ssize_t n = eeprom_file_read_fd(f, f->zbuf,
+							      f->zbuf_size);
+
+			if (n < 0)
+				return -1;
+
+			if (!n) {
+				LOG("truncated compressed data");
+				return -1;
+			}
+
+			f->z.next_in = (Bytef *) f->zbuf;
+			f->z.avail_in = n;
+		}
+
+		stat = inflate(&f->z, Z_NO_FLUSH);
+
+		if (stat == Z_STREAM_END) {
+			f->z_end = 1;
+		} else if (stat != Z_OK) {
+			LOG("invalid compressed data");
+			return -1;
+		}
+	}
+
+	return size - f->z.avail_out;
+}
+
+static int eeprom_file_deflate(struct eeprom_file *f, int flush)
+{
+	int stat;
+
+	do {
+		stat = deflate(&f->z, flush);
+
+		if (stat == Z_STREAM_ERROR)
+			return -1;
+
+		if (!f->z.avail_out || (stat == Z_STREAM_END)) {
+			const size_t n = f->zbuf_size - f->z.avail_out;
+
+			if (write_full(f->fd, f->zbuf, n) < 0)
+				return -1;
+
+			f->z.next_out = (Bytef *) f->zbuf;
+			f->z.avail_out = f->zbuf_size;
+		}
+	} while (f->z.avail_in
+		 || ((flush == Z_FINISH) && (stat != Z_STREAM_END)));
+
+	return 0;
+}
+
+static int eeprom_file_put(struct eeprom_file *f, const char *data,
+			   size_t size)
+{
+	if (f->compress == EEPROM_COMPRESS_NONE)
+		return write_full(f->fd, data, size);
+
+	f->z.next_in = (Bytef *) data;
+	f->z.avail_in = size;
+
+	return eeprom_file_deflate(f, Z_NO_FLUSH);
+}
+
+/* The hexdump lines always have 16 bytes, the remaining ones are kept until
+ * the next call. */
+static int eeprom_file_write(struct eeprom_file *f, const char *data,
+			     size_t size)
+{
+	char *out = f->text;
+
+	if (f->text == NULL)
+		return eeprom_file_put(f, data, size);
+
+	while (size) {
+		const size_t n = min((16 - f->line_len), size);
+
+		memcpy(&f->line[f->line_len], data, n);
+		f->line_len += n;
+		data += n;
+		size -= n;
+
+		if (f->line_len == 16) {
+			out += format_hex_line(out, f->offset, f->line, 16);
+			f->offset += 16;
+			f->line_len = 0;
+		}
+	}
+
+	return eeprom_file_put(f, f->text, (out - f->text));
+}
+
+/* Write the last hexdump line and the end of the compressed stream */
+static int eeprom_file_finish(struct eeprom_file *f)
+{
+	if ((f->text != NULL) && f->line_len) {
+		const size_t n = format_hex_line(f->text, f->offset, f->line,
+						 f->line_len);
+
+		if (eeprom_file_put(f, f->text, n))
+			return -1;
+	}
+
+	if (f->compress == EEPROM_COMPRESS_NONE)
+		return 0;
+
+	f->z.avail_in = 0;
+
+	return eeprom_file_deflate(f, Z_FINISH);
+}
+
+/* -- pipelined transfers -- */
+
+/* Ring of buffers filled by a producer and emptied by a consumer, one of
+ * them being the worker thread doing the file I/O and the other one the
+ * main thread doing the EEPROM transfers. */
+struct eeprom_ring {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	char **bufs;
+	size_t *sizes;
+	size_t n_bufs;
+	size_t buf_size;
+	size_t head;
+	size_t count;
+	int done;
+	int error;
+	struct eeprom_file *file;
+	size_t data_size;
+};
+
+static int eeprom_ring_init(struct eeprom_ring *ring, size_t n_bufs,
+			    size_t buf_size)
+{
+	size_t i;
+
+	ring->bufs = calloc(n_bufs, sizeof(char *));
+	ring->sizes = calloc(n_bufs, sizeof(size_t));
+
+	if ((ring->bufs == NULL) || (ring->sizes == NULL))
+		goto err_free;
+
+	for (i = 0; i < n_bufs; ++i) {
+		ring->bufs[i] = malloc(buf_size);
+
+		if (ring->bufs[i] == NULL)
+			goto err_free;
+	}
+
+	pthread_mutex_init(&ring->lock, NULL);
+	pthread_cond_init(&ring->cond, NULL);
+	ring->n_bufs = n_bufs;
+	ring->buf_size = buf_size;
+	ring->head = 0;
+	ring->count = 0;
+	ring->done = 0;
+	ring->error = 0;
+
+	return 0;
+
+err_free:
+	if (ring->bufs != NULL)
+		for (i = 0; i < n_bufs; ++i)
+			free(ring->bufs[i]);
+
+	free(ring->bufs);
+	free(ring->sizes);
+
+	return -1;
+}
+
+static void eeprom_ring_free(struct eeprom_ring *ring)
+{
+	size_t i;
+
+	for (i = 0; i < ring->n_bufs; ++i)
+		free(ring->bufs[i]);
+
+	free(ring->bufs);
+	free(ring->sizes);
+	pthread_cond_destroy(&ring->cond);
+	pthread_mutex_destroy(&ring->lock);
+}
+
+/* Producer side: get the next empty buffer, or NULL on error */
+static char *eeprom_ring_get_free(struct eeprom_ring *ring)
+{
+	char *buf;
+
+	pthread_mutex_lock(&ring->lock);
+
+	while ((ring->count == ring->n_bufs) && !ring->error)
+		pthread_cond_wait(&ring->cond, &ring->lock);
+
+	buf = ring->error ? NULL :
+		ring->bufs[(ring->head + ring->count) % ring->n_bufs];
+	pthread_mutex_unlock(&ring->lock);
+
+	return buf;
+}
+
+static void eeprom_ring_put(struct eeprom_ring *ring, size_t size)
+{
+	pthread_mutex_lock(&ring->lock);
+	ring->sizes[(ring->head + ring->count) % ring->n_bufs] = size;
+	ring->count++;
+	pthread_cond_broadcast(&ring->cond);
+	pthread_mutex_unlock(&ring->lock);
+}
+
+/* Consumer side: get the next full buffer, or NULL when done or on error */
+static char *eeprom_ring_get(struct eeprom_ring *ring, size_t *size)
+{
+	char *buf = NULL;
+
+	pthread_mutex_lock(&ring->lock);
+
+	while (!ring->count && !ring->done && !ring->error)
+		pthread_cond_wait(&ring->cond, &ring->lock);
+
+	if (ring->count && !ring->error) {
+		buf = ring->bufs[ring->head];
+		*size = ring->sizes[ring->head];
+	}
+
+	pthread_mutex_unlock(&ring->lock);
+
+	return buf;
+}
+
+static void eeprom_ring_release(struct eeprom_ring *ring)
+{
+	pthread_mutex_lock(&ring->lock);
+	ring->head = (ring->head + 1) % ring->n_bufs;
+	ring->count--;
+	pthread_cond_broadcast(&ring->cond);
+	pthread_mutex_unlock(&ring->lock);
+}
+
+static void eeprom_ring_set_done(struct eeprom_ring *ring, int error)
+{
+	pthread_mutex_lock(&ring->lock);
+
+	if (error)
+		ring->error = 1;
+	else
+		ring->done = 1;
+
+	pthread_cond_broadcast(&ring->cond);
+	pthread_mutex_unlock(&ring->lock);
+}
+
+static void *eeprom_ring_file_reader(void *data)
+{
+	struct eeprom_ring *ring = data;
+	size_t left = ring->data_size;
+	int error = 0;
+
+	while (left) {
+		char *buf = eeprom_ring_get_free(ring);
+		ssize_t n;
+
+		if (buf == NULL)
+			return NULL;
+
+		n = eeprom_file_read(ring->file, buf,
+				     min(left, ring->buf_size));
+
+		if (n < 0) {
+			if (errno != ECANCELED)
+				LOG("failed to read the file");
+
+			error = 1;
+			break;
+		}
+
+		if (n)
+			eeprom_ring_put(ring, n);
+
+		if ((size_t) n < min(left, ring->buf_size))
+			break;
+
+		left -= n;
+	}
+
+	eeprom_ring_set_done(ring, error);
+
+	return NULL;
+}
+
+static void *eeprom_ring_file_writer(void *data)
+{
+	struct eeprom_ring *ring = data;
+	const char *buf;
+	size_t n;
+
+	while ((buf = eeprom_ring_get(ring, &n)) != NULL) {
+		if (eeprom_file_write(ring->file, buf, n) < 0) {
+			LOG("failed to write the file");
+			eeprom_ring_set_done(ring, 1);
+			break;
+		}
+
+		eeprom_ring_release(ring);
+	}
+
+	return NULL;
+}
+
+static int pipe_file_eeprom(struct eeprom *eeprom, int fd, int write_file,
+			    const struct eeprom_opt *opt)
+{
+	const int verify = (opt->write_mode == EEPROM_WRITE_VERIFY);
+	const char *msg = write_file ? "Reading" : verify ? "Verifying" :
+		"Writing";
+	const size_t page_size = get_eeprom_page_size(opt);
+	const size_t buf_size = (opt->buffer_size > page_size) ?
+		(opt->buffer_size - (opt->buffer_size % page_size)) : page_size;
+	const size_t n_bufs = opt->pipeline ? opt->pipeline : 2;
+	struct eeprom_write_stats stats = { 0, 0 };
+	struct eeprom_file file;
+	struct eeprom_ring ring;
+	pthread_t thread;
+	int wake[2];
+	size_t done = 0;
+	int ret = 0;
+
+	if (eeprom_file_init(&file, fd, write_file, opt, buf_size)) {
+		LOG("failed to initialise the file");
+		return -1;
+	}
+
+	if (eeprom_ring_init(&ring, n_bufs, buf_size)) {
+		LOG("failed to allocate pipeline buffers");
+		eeprom_file_free(&file);
+		return -1;
+	}
+
+	/* The reader thread may be blocked on a pipe when stopping early */
+	if (pipe(wake) < 0) {
+		LOG("failed to create the wake-up pipe");
+		eeprom_ring_free(&ring);
+		eeprom_file_free(&file);
+		return -1;
+	}
+
+	file.wake_fd = wake[0];
+	ring.file = &file;
+	ring.data_size = opt->data_size;
+
+	if (pthread_create(&thread, NULL, (write_file ?
+					   eeprom_ring_file_writer :
+					   eeprom_ring_file_reader), &ring)) {
+		LOG("failed to create pipeline thread");
+		close(wake[0]);
+		close(wake[1]);
+		eeprom_ring_free(&ring);
+		eeprom_file_free(&file);
+		return -1;
+	}
+
+	if (write_file) {
+		g_hw->eeprom_seek(eeprom, opt->skip);
+
+		while ((done < opt->data_size) && !g_abort) {
+			const size_t n = min(buf_size, (opt->data_size - done));
+			char *buf = eeprom_ring_get_free(&ring);
+
+			if (buf == NULL) {
+				ret = -1;
+				break;
+			}
+
+			if (g_hw->eeprom_read(eeprom, buf, n) < 0) {
+				ret = -1;
+				break;
+			}
+
+			eeprom_ring_put(&ring, n);
+			done += n;
+			log_eeprom_progress(opt->data_size,
+					    (opt->data_size - done), msg);
+		}
+	} else {
+		const char *buf;
+		size_t n;
+
+		while (!g_abort
+		       && ((buf = eeprom_ring_get(&ring, &n)) != NULL)) {
+			if (write_eeprom_data(eeprom, (opt->skip + done), buf,
+					      n, opt, &stats)) {
+				ret = -1;
+				break;
+			}
+
+			eeprom_ring_release(&ring);
+			done += n;
+			log_eeprom_progress(opt->data_size,
+					    (opt->data_size - done), msg);
+		}
+	}
+
+	eeprom_ring_set_done(&ring, (ret || g_abort));
+
+	if ((ret || g_abort) && (write_full(wake[1], "", 1) < 0))
+		LOG("failed to wake up the pipeline thread");
+
+	pthread_join(thread, NULL);
+	close(wake[0]);
+	close(wake[1]);
+
+	if (ring.error)
+		ret = -1;
+
+	eeprom_ring_free(&ring);
+
+	if (!ret && write_file && eeprom_file_finish(&file)) {
+		LOG("failed to write the file");
+		ret = -1;
+	}
+
+	eeprom_file_free(&file);
+
+	if (!ret && !write_file && (done < opt->data_size)
+	    && opt->zero_padding) {
+		LOG_PRINT("\n");
+		ret = pad_eeprom(eeprom, (opt->data_size - done), opt, &stats);
+	}
+
+	LOG_PRINT("\n");
+
+	if (verify) {
+		LOG("%zu pages identical, %zu pages different",
+		    stats.pages_skipped, stats.pages_written);
+
+		if (stats.pages_written)
+			ret = -1;
+	} else if (opt->write_mode == EEPROM_WRITE_DIFF) {
+		LOG("%zu pages written, %zu pages skipped",
+		    stats.pages_written, stats.pages_skipped);
+	}
+
+	return ret;
+}
+
+static int parse_eeprom_opt(struct ctx *ctx, struct eeprom_opt *eopt)
+{
+	const size_t opt_size = strlen(g_opt) + 1;
+	static const char *sep = ", ";
+	char *opt_str;
+	char *opt;
+	int ret = 0;
+
+	opt_str = malloc(opt_size);
+	assert(opt_str != NULL);
+	memcpy(opt_str, g_opt, opt_size);
+
+	while ((opt = strsep(&opt_str, sep)) != NULL) {
+		static const char *opt_sep = "=";
+		char *key;
+		char *str_value;
+		unsigned long ul_value = 0;
+		int is_int;
+
+		key = strsep(&opt, opt_sep);
+
+		if (key == NULL) {
+			LOG("invalid EEPROM option");
+			return -1;
+		}
+
+		str_value = strsep(&opt, opt_sep);
+
+		if (str_value) {
+			errno = 0;
+			ul_value = strtoul(str_value, NULL, 10);
+			is_int = errno ? 0 : 1;
+		} else {
+			is_int = 0;
+		}
+
+		if (!strcmp(key, "i2c_block_size")) {
+			if (!is_int) {
+				LOG("no or invalid I2C block size");
+				ret = -1;
+				goto exit_now;
+			}
+
+			LOG("I2C block size: %lu", ul_value);
+			eopt->block_size = ul_value;
+		} else if (!strcmp(key, "page_size")) {
+			if (!is_int) {
+				LOG("no or invalid EEPROM page size");
+				ret = -1;
+				goto exit_now;
+			}
+
+			LOG("EEPROM page size: %lu", ul_value);
+			eopt->page_size = ul_value;
+		} else if (!strcmp(key, "zero_padding")) {
+			LOG("zero-padding enabled");
+			eopt->zero_padding = 1;
+		} else if (!strcmp(key, "buffer_size")) {
+			if (!is_int || !ul_value) {
+				LOG("no or invalid buffer size");
+				ret = -1;
+				goto exit_now;
+			}
+
+			LOG("buffer size: %lu", ul_value);
+			eopt->buffer_size = ul_value;
+		} else if (!strcmp(key, "pipeline")) {
+			if (str_value == NULL) {
+				ul_value = 2;
+			} else if (!is_int || (ul_value < 2)) {
+				LOG("invalid number of pipeline buffers");
+				ret = -1;
+				goto exit_now;
+			}
+
+			LOG("pipelined transfers with %lu buffers", ul_value);
+			eopt->pipeline = ul_value;
+		} else if (!strcmp(key, "compress")) {
+			if ((str_value == NULL) || !strcmp(str_value, "gzip")) {
+				eopt->compress = EEPROM_COMPRESS_GZIP;
+			} else if (!strcmp(str_value, "rle")) {
+				eopt->compress = EEPROM_COMPRESS_RLE;
+			} else if (!strcmp(str_value, "none")) {
+				eopt->compress = EEPROM_COMPRESS_NONE;
+			} else {
+				LOG("invalid compression: %s", str_value);
+				ret = -1;
+				goto exit_now;
+			}
+
+			LOG("compression: %s", str_value ? str_value : "gzip");
+		} else if (!strcmp(key, "pattern")) {
+			if (str_value == NULL) {
+				LOG("no test pattern specified");
+				ret = -1;
+				goto exit_now;
+			} else if (parse_eeprom_pattern(str_value,
+							&eopt->pattern)) {
+				LOG("invalid test pattern: %s", str_value);
+				ret = -1;
+				goto exit_now;
+			}
+		} else if (!strcmp(key, "seed")) {
+			if (!is_int || !ul_value) {
+				LOG("no or invalid seed");
+				ret = -1;
+				goto exit_now;
+			}
+
+			eopt->seed = ul_value;
+		} else if (!strcmp(key, "journal")) {
+			if ((str_value == NULL)
+			    || (strlen(str_value) >= PATH_MAX)) {
+				LOG("no or invalid journal file name");
+				ret = -1;
+				goto exit_now;
+			}
+
+			LOG("journal: %s", str_value);
+			strcpy(eopt->journal, str_value);
+		} else if (!strcmp(key, "resume")) {
+			LOG("resuming from the journal");
+			eopt->resume = 1;
+		} else if (!strcmp(key, "cache")) {
+			if ((str_value == NULL)
+			    || (strlen(str_value) >= sizeof(eopt->cache))) {
+				LOG("no or invalid cache directory");
+				ret = -1;
+				goto exit_now;
+			}
+
+			LOG("cache: %s", str_value);
+			strcpy(eopt->cache, str_value);
+		} else if (!strcmp(key, "ranges")) {
+			if ((str_value == NULL)
+			    || parse_eeprom_ranges(str_value, eopt)) {
+				LOG("no or invalid list of ranges");
+				ret = -1;
+				goto exit_now;
+			}
+		} else if (!strcmp(key, "layout")) {
+			if ((str_value == NULL)
+			    || load_eeprom_layout(str_value, eopt)) {
+				LOG("no or invalid layout file");
+				ret = -1;
+				goto exit_now;
+			}
+		} else if (!strcmp(key, "hexdump")) {
+			LOG("hexdump output");
+			eopt->hexdump = 1;
+		} else if (!strcmp(key, "force")) {
+			LOG("forcing display data with an invalid CRC");
+			eopt->force = 1;
+		} else if (!strcmp(key, "diff")) {
+			LOG("only writing pages with different data");
+			eopt->write_mode = EEPROM_WRITE_DIFF;
+		} else if (!strcmp(key, "data_size")) {
+			if (!is_int) {
+				LOG("no or invalid data size");
+				ret = -1;
+				goto exit_now;
+			}
+
+			LOG("data size: %lu", ul_value);
+			eopt->data_size = ul_value;
+		} else if (!strcmp(key, "skip")) {
+			if (!is_int) {
+				LOG("no or invalid skip size specified");
+				ret = -1;
+				goto exit_now;
+			}
+
+			LOG("skip: %lu", ul_value);
+			eopt->skip = ul_value;
+		} else if (!strcmp(key, "bench_blocks")
+			   || !strcmp(key, "bench_pages")
+			   || !strcmp(key, "bench_lengths")) {
+			unsigned long *values;
+			size_t *n_values;
+			int n;
+
+			if (!strcmp(key, "bench_blocks")) {
+				values = eopt->bench_blocks;
+				n_values = &eopt->n_bench_blocks;
+			} else if (!strcmp(key, "bench_pages")) {
+				values = eopt->bench_pages;
+				n_values = &eopt->n_bench_pages;
+			} else {
+				values = eopt->bench_lengths;
+				n_values = &eopt->n_bench_lengths;
+			}
+
+			n = (str_value == NULL) ? -1 : parse_ul_list(
+				str_value, values, EEPROM_BENCH_MAX);
+
+			if (n <= 0) {
+				LOG("no or invalid list of values for %s", key);
+				ret = -1;
+				goto exit_now;
+			}
+
+			*n_values = n;
+		} else if (!strcmp(key, "addr")) {
+			if (str_value == NULL) {
+				LOG("no I2C address configuration specified");
+				ret = -1;
+				goto exit_now;
+			}
+
+			eopt->i2c_addr = plconfig_get_i2c_addr(
+				ctx->config, str_value, PLHW_NO_I2C_ADDR);
+
+			if (eopt->i2c_addr != PLHW_NO_I2C_ADDR) {
+				LOG("I2C address (%s): 0x%02X",
+				    str_value, eopt->i2c_addr);
+			} else {
+				LOG("failed to find I2C address in config: %s",
+				    str_value);
+			}
+		} else {
+			LOG("invalid option name: %s", key);
+			ret = -1;
+			goto exit_now;
+		}
+	}
+
+exit_now:
+	free(opt_str);
+
+	return ret;
+}
+
+static int parse_eeprom_pattern(const char *str, enum eeprom_pattern *pattern)
+{
+	if (!strcmp(str, "random"))
+		*pattern = EEPROM_PATTERN_RANDOM;
+	else if (!strcmp(str, "walking"))
+		*pattern = EEPROM_PATTERN_WALKING;
+	else if (!strcmp(str, "address"))
+		*pattern = EEPROM_PATTERN_ADDRESS;
+	else if (!strcmp(str, "checker"))
+		*pattern = EEPROM_PATTERN_CHECKER;
+	else
+		return -1;
+
+	return 0;
+}
+
+/* -- gang programming -- */
+
+struct eeprom_gang;
+
+struct eeprom_gang_target {
+	struct eeprom_gang *gang;
+	char *i2c_bus;
+	unsigned i2c_addr;
+	pthread_t thread;
+	int started;
+	int finished;
+	int ret;
+	const char *status;
+	struct eeprom_write_stats stats;
+	size_t pages_different;
+};
+
+struct eeprom_gang {
+	const char *mode;
+	const char *image;
+	size_t size;
+	const struct eeprom_opt *opt;
+	pthread_mutex_t lock;
+	size_t done;
+	unsigned finished;
+};
+
+static void eeprom_gang_progress(struct eeprom_gang *gang, size_t n)
+{
+	pthread_mutex_lock(&gang->lock);
+	gang->done += n;
+	pthread_mutex_unlock(&gang->lock);
+}
+
+/* Write the image to one EEPROM and then read it back to verify it */
+static int eeprom_gang_program(struct eeprom_gang_target *t,
+			       struct eeprom *eeprom)
+{
+	struct eeprom_gang *gang = t->gang;
+	struct eeprom_opt opt = *gang->opt;
+	struct eeprom_write_stats verify_stats = { 0, 0 };
+	size_t done;
+
+	if (g_hw->eeprom_get_size(eeprom) < (opt.skip + gang->size)) {
+		t->status = "image bigger than EEPROM";
+		return -1;
+	}
+
+	if (opt.block_size)
+		g_hw->eeprom_set_block_size(eeprom, opt.block_size);
+
+	if (opt.page_size)
+		g_hw->eeprom_set_page_size(eeprom, opt.page_size);
+
+	for (done = 0; done < gang->size; done += opt.buffer_size) {
+		const size_t n = min(opt.buffer_size, (gang->size - done));
+
+		if (g_abort) {
+			t->status = "aborted";
+			return -1;
+		}
+
+		if (write_eeprom_data(eeprom, (opt.skip + done),
+				      &gang->image[done], n, &opt,
+				      &t->stats)) {
+			t->status = "write failed";
+			return -1;
+		}
+
+		eeprom_gang_progress(gang, n);
+	}
+
+	opt.write_mode = EEPROM_WRITE_VERIFY;
+
+	for (done = 0; done < gang->size; done += opt.buffer_size) {
+		const size_t n = min(opt.buffer_size, (gang->size - done));
+
+		if (g_abort) {
+			t->status = "aborted";
+			return -1;
+		}
+
+		if (write_eeprom_data(eeprom, (opt.skip + done),
+				      &gang->image[done], n, &opt,
+				      &verify_stats)) {
+			t->status = "read failed";
+			return -1;
+		}
+
+		eeprom_gang_progress(gang, n);
+	}
+
+	t->pages_different = verify_stats.pages_written;
+
+	if (t->pages_different) {
+		t->status = "verify failed";
+		return -1;
+	}
+
+	t->status = "ok";
+
+	return 0;
+}
+
+static void *eeprom_gang_run(void *data)
+{
+	struct eeprom_gang_target *t = data;
+	struct eeprom_gang *gang = t->gang;
+	struct eeprom *eeprom;
+
+	eeprom = g_hw->eeprom_init(t->i2c_bus, t->i2c_addr, gang->mode);
+
+	if (eeprom == NULL) {
+		t->status = "init failed";
+		t->ret = -1;
+	} else {
+		t->ret = eeprom_gang_program(t, eeprom);
+		g_hw->eeprom_free(eeprom);
+	}
+
+	pthread_mutex_lock(&gang->lock);
+	t->finished = 1;
+	gang->finished++;
+	pthread_mutex_unlock(&gang->lock);
+
+	return NULL;
+}
+
+static int gang_eeprom(const char *mode, unsigned i2c_addr, int argc,
+		       char **argv, struct eeprom_opt *opt)
+{
+	const size_t esize = get_eeprom_mode_size(mode);
+	struct eeprom_gang gang;
+	struct eeprom_gang_target *targets;
+	const char *f_name;
+	char *image;
+	unsigned n_targets;
+	unsigned n_started = 0;
+	unsigned n_failed = 0;
+	size_t total;
+	ssize_t n_read;
+	int fd;
+	unsigned i;
+
+	if (argc < 2) {
+		LOG("invalid arguments");
+		return -1;
+	}
+
+	if (!esize) {
+		LOG("invalid EEPROM mode: %s", mode);
+		return -1;
+	}
+
+	if (!opt->data_size) {
+		opt->data_size = esize - min(opt->skip, esize);
+	} else if (opt->data_size > esize) {
+		LOG("data size bigger than EEPROM size");
+		return -1;
+	}
+
+	f_name = argv[0];
+	n_targets = argc - 1;
+	targets = calloc(n_targets, sizeof(struct eeprom_gang_target));
+	image = calloc(1, opt->data_size);
+
+	if ((targets == NULL) || (image == NULL)) {
+		LOG("failed to allocate memory");
+		free(targets);
+		free(image);
+		return -1;
+	}
+
+	for (i = 0; i < n_targets; ++i) {
+		struct eeprom_gang_target *t = &targets[i];
+		char *addr_str;
+
+		t->gang = &gang;
+		t->i2c_bus = strdup(argv[i + 1]);
+		assert(t->i2c_bus != NULL);
+		t->i2c_addr = i2c_addr;
+		addr_str = strrchr(t->i2c_bus, '@');
+
+		/* The address is in hexadecimal as with the -a option */
+		if (addr_str != NULL) {
+			unsigned long addr;
+			char *end;
+
+			*addr_str++ = '\0';
+			errno = 0;
+			addr = strtoul(addr_str, &end, 16);
+
+			if (errno || (end == addr_str) || (*end != '\0')
+			    || (addr > 0x7F)) {
+				LOG("invalid I2C address: %s", addr_str);
+				n_failed++;
+			}
+
+			t->i2c_addr = addr;
+		}
+	}
+
+	if (n_failed)
+		goto exit_free;
+
+	fd = open(f_name, O_RDONLY);
+
+	if (fd < 0) {
+		LOG("failed to open the file (%s)", f_name);
+		n_failed = n_targets;
+		goto exit_free;
+	}
+
+	n_read = read_full(fd, image, opt->data_size);
+	close(fd);
+
+	if (n_read <= 0) {
+		LOG("failed to read the image (%s)", f_name);
+		n_failed = n_targets;
+		goto exit_free;
+	}
+
+	gang.mode = mode;
+	gang.image = image;
+	gang.size = opt->zero_padding ? opt->data_size : n_read;
+	gang.opt = opt;
+	gang.done = 0;
+	gang.finished = 0;
+	pthread_mutex_init(&gang.lock, NULL);
+
+	for (i = 0; i < n_targets; ++i) {
+		struct eeprom_gang_target *t = &targets[i];
+
+		if (pthread_create(&t->thread, NULL, eeprom_gang_run, t)) {
+			LOG("failed to create thread for %s", t->i2c_bus);
+			t->status = "not started";
+			t->ret = -1;
+		} else {
+			t->started = 1;
+			n_started++;
+		}
+	}
+
+	/* Programming and verification are both accounted for */
+	total = 2 * gang.size * n_started;
+
+	for (;;) {
+		size_t done;
+		unsigned finished;
+
+		pthread_mutex_lock(&gang.lock);
+		done = gang.done;
+		finished = gang.finished;
+		pthread_mutex_unlock(&gang.lock);
+
+		if (total)
+			log_eeprom_progress(total, (total - done), "Gang");
+
+		if (finished == n_started)
+			break;
+
+		sleep_us(100000);
+	}
+
+	LOG_PRINT("\n");
+
+	for (i = 0; i < n_targets; ++i) {
+		struct eeprom_gang_target *t = &targets[i];
+
+		if (t->started)
+			pthread_join(t->thread, NULL);
+
+		if (t->ret)
+			n_failed++;
+
+		if (t->i2c_addr == PLHW_NO_I2C_ADDR)
+			printf("%s", t->i2c_bus);
+		else
+			printf("%s@0x%02X", t->i2c_bus, t->i2c_addr);
+
+		printf("\t%s\t%s", (t->ret ? "FAIL" : "PASS"), t->status);
+
+		if (t->pages_different)
+			printf(" (%zu pages different)", t->pages_different);
+		else if (!t->ret && (opt->write_mode == EEPROM_WRITE_DIFF))
+			printf(" (%zu pages written, %zu pages skipped)",
+			       t->stats.pages_written, t->stats.pages_skipped);
+
+		printf("\n");
+	}
+
+	pthread_mutex_destroy(&gang.lock);
+	LOG("%u/%u EEPROMs programmed and verified",
+	    (n_targets - n_failed), n_targets);
+
+exit_free:
+	for (i = 0; i < n_targets; ++i)
+		free(targets[i].i2c_bus);
+
+	free(targets);
+	free(image);
+
+	return n_failed ? -1 : 0;
+}
+
+/* The progress is shown at most every PROGRESS_INTERVAL_US and always at
+ * the end, with the throughput and ETA since the transfer started.  A new
+ * transfer starts when the message or total changes, or when the progress
+ * goes backwards. */
+static void log_eeprom_progress(size_t total, size_t rem, const char *msg)
+{
+	static const unsigned long long PROGRESS_INTERVAL_US = 200000;
+	static struct {
+		char msg[32];
+		size_t total;
+		size_t start;
+		size_t prog;
+		unsigned long long start_us;
+		unsigned long long last_us;
+	} p = { .msg = "" };
+	const size_t prog = total - rem;
+	const int prog_percent = total ? (prog * 100 / total) : 100;
+	const unsigned long long now = get_time_us();
+	char rate_str[32] = "null";
+	char eta_str[32] = "null";
+	double elapsed;
+	double rate;
+	double eta;
+
+	if (strncmp(p.msg, msg, sizeof(p.msg)) || (p.total != total)
+	    || (prog < p.prog)) {
+		strncpy(p.msg, msg, (sizeof(p.msg) - 1));
+		p.msg[sizeof(p.msg) - 1] = '\0';
+		p.total = total;
+		p.start = total - rem;
+		p.start_us = now;
+	} else if (rem && ((now - p.last_us) < PROGRESS_INTERVAL_US)) {
+		p.prog = prog;
+		return;
+	}
+
+	p.prog = prog;
+	p.last_us = now;
+	elapsed = (now - p.start_us) / 1000000.0;
+
+	/* The rate is only known once some data has been transferred since
+	 * the first sample */
+	if ((elapsed > 0) && (prog > p.start)) {
+		rate = (prog - p.start) / elapsed;
+		eta = rem / rate;
+		snprintf(rate_str, sizeof(rate_str), "%.0f", rate);
+		snprintf(eta_str, sizeof(eta_str), "%.3f", eta);
+		LOG_PRINT("\r%s EEPROM... %i%% (%zu) %.1f KiB/s, ETA %.0fs   ",
+			  msg, prog_percent, prog, (rate / 1024), eta);
+	} else {
+		LOG_PRINT("\r%s EEPROM... %i%% (%zu)   ", msg, prog_percent,
+			  prog);
+	}
+
+	if (g_progress_fd >= 0) {
+		char line[256];
+		const int n = snprintf(
+			line, sizeof(line), "{\"op\":\"%s\",\"done\":%zu,"
+			"\"total\":%zu,\"percent\":%d,\"bytes_per_s\":%s,"
+			"\"elapsed_s\":%.3f,\"eta_s\":%s}\n", msg, prog,
+			total, prog_percent, rate_str, elapsed, eta_str);
+		const size_t len = min((size_t) n, sizeof(line));
+
+		if ((n > 0) && (write_full(g_progress_fd, line, len) < 0)) {
+			LOG("Warning: failed to write progress, disabling it");
+			g_progress_fd = -1;
+		}
+	}
+}
+
+/* The mode names follow the 24cXX convention, XX being the size in Kbits */
+static size_t get_eeprom_mode_size(const char *mode)
+{
+	unsigned long kbits;
+
+	if (strncmp(mode, "24c", 3) || parse_ul(&mode[3], &kbits) || !kbits)
+		return 0;
+
+	return kbits * 128;
+}
+
+static size_t get_eeprom_page_size(const struct eeprom_opt *opt)
+{
+	return opt->page_size ? opt->page_size : opt->mode_page_size;
+}
+
+static size_t get_eeprom_mode_page_size(const char *mode)
+{
+	const size_t size = get_eeprom_mode_size(mode);
+
+	if (size <= 256)
+		return 8;
+
+	if (size <= 2048)
+		return 16;
+
+	if (size <= 8192)
+		return 32;
+
+	if (size <= 32768)
+		return 64;
+
+	if (size <= 65536)
+		return 128;
+
+	return 256;
+}
+
+/* ----------------------------------------------------------------------------
+ * Power
+ */
+
+static int run_power(struct ctx *ctx, int argc, char **argv)
+{
+	struct power_steps steps;
+	const struct power_step *run_steps;
+	unsigned long long durations[POWER_STEPS_MAX];
+	unsigned long long t0;
+	struct power_opt popt;
+	size_t n_steps;
+	size_t n_done;
+	char vcom = 0;
+	int stat;
+	int on;
+
+	if (argc < 1) {
+		LOG("invalid arguments");
+		return -1;
+	}
+
+	on = get_on_off_opt(argv[0]);
+
+	if (on < 0) {
+		LOG("invalid arguments (possible values are `on' or `off')");
+		return -1;
+	}
+
+	if (parse_power_opt(ctx, &popt))
+		return -1;
+
+	if (load_power_seq(ctx, ((argc > 1) ? argv[1] : NULL), &steps)) {
+		free(popt.buffer);
+		return -1;
+	}
+
+	if (on) {
+		/* ToDo: get the VCOM as floating point in volts */
+		vcom = 128;
+
+		if (argc > 2) {
+			const int vcom_raw = atoi(argv[2]);
+
+			if ((vcom_raw < 0) || (vcom_raw > 255))
+				LOG("invalid vcom value (valid range: 0-255)");
+			else
+				vcom = (char) vcom_raw;
+		}
+
+		run_steps = steps.on;
+		n_steps = steps.n_on;
+	} else {
+		run_steps = steps.off;
+		n_steps = steps.n_off;
+	}
+
+	t0 = get_time_us();
+	stat = run_power_steps(ctx, run_steps, n_steps, vcom, popt.pok_gpio,
+			       durations, &n_done);
+	report_power_steps(run_steps, durations, n_done, (get_time_us() - t0));
+
+	if ((popt.csv != NULL)
+	    && save_power_steps(popt.csv,
+				((argc > 1) ? argv[1] : seqs[0].name), on,
+				run_steps, durations, n_done, n_steps, stat)) {
+		LOG("failed to save the step timings (%s)", popt.csv);
+		stat = -1;
+	}
+
+	if (!stat)
+		LOG("Power %s", on ? "on" : "off");
+
+	free(popt.buffer);
+
+	return stat;
+}
+
+/* The pok_gpio option defaults to the pok-gpio value from plsdk.ini */
+static int parse_power_opt(struct ctx *ctx, struct power_opt *popt)
+{
+	char *opt_it;
+	char *opt;
+
+	popt->csv = NULL;
+	popt->pok_gpio = plconfig_get_str(ctx->config, "pok-gpio", NULL);
+	popt->buffer = NULL;
+
+	if (g_opt == NULL)
+		return 0;
+
+	popt->buffer = opt_it = strdup(g_opt);
+	assert(popt->buffer != NULL);
+
+	while ((opt = strsep(&opt_it, ",")) != NULL) {
+		const char *key = strsep(&opt, "=");
+
+		if ((opt == NULL) || (*opt == '\0')) {
+			LOG("invalid power option: %s", key);
+			free(popt->buffer);
+			return -1;
+		}
+
+		if (!strcmp(key, "csv")) {
+			popt->csv = opt;
+		} else if (!strcmp(key, "pok_gpio")) {
+			popt->pok_gpio = opt;
+		} else {
+			LOG("invalid power option: %s", key);
+			free(popt->buffer);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* The sequence is either a built-in one, a file when the name contains a
+ * `/', or the power-seq-NAME value from plsdk.ini.  This value contains
+ * either the steps or the path to a file when it starts with a `/'. */
+static int load_power_seq(struct ctx *ctx, const char *name,
+			  struct power_steps *steps)
+{
+	const struct power_seq *seq;
+	char key[64];
+	const char *path;
+	const char *text;
+	char *buffer = NULL;
+	int ret;
+
+	if (name == NULL)
+		return compile_power_seq(seqs[0].name, seqs[0].steps, steps);
+
+	for (seq = seqs; seq->name != NULL; ++seq)
+		if (!strcmp(name, seq->name))
+			return compile_power_seq(seq->name, seq->steps, steps);
+
+	if (strchr(name, '/') != NULL) {
+		path = name;
+		text = NULL;
+	} else {
+		snprintf(key, sizeof(key), "power-seq-%s", name);
+		text = plconfig_get_str(ctx->config, key, NULL);
+
+		if (text == NULL) {
+			LOG("Sequence not found: %s", name);
+			return -1;
+		}
+
+		path = (text[0] == '/') ? text : NULL;
+	}
+
+	if (path != NULL) {
+		FILE *f = fopen(path, "r");
+		size_t size = 0;
+
+		if ((f == NULL) || (getdelim(&buffer, &size, '\0', f) < 0)) {
+			LOG("failed to read the sequence file (%s)", path);
+			free(buffer);
+
+			if (f != NULL)
+				fclose(f);
+
+			return -1;
+		}
+
+		fclose(f);
+		text = buffer;
+	}
+
+	ret = compile_power_seq(name, text, steps);
+	free(buffer);
+
+	return ret;
+}
+
+/* With cpld set, the id and value are the masks of the switches to set and
+ * of the ones to turn on. */
+static int compile_cpld_switches(char **args, int n, struct power_step *step)
+{
+	struct cpld_stage stage = { 0, 0 };
+	size_t len;
+	int i;
+
+	strcpy(step->desc, "cpld set");
+	len = strlen(step->desc);
+
+	for (i = 3; (i < n) && (strchr(args[i], '=') != NULL); ++i) {
+		if (stage_cpld_switch(&stage, args[i]))
+			return -1;
+
+		if (len < sizeof(step->desc))
+			len += snprintf(&step->desc[len],
+					(sizeof(step->desc) - len), " %s",
+					args[i]);
+	}
+
+	if (!stage.mask || (i < (n - 1)))
+		return -1;
+
+	step->action = POWER_CPLD_SWITCHES;
+	step->id = stage.mask;
+	step->value = stage.on_mask;
+	step->delay_ms = 0;
+
+	if ((i < n) && parse_ul(args[i], &step->delay_ms))
+		return -1;
+
+	return 0;
+}
+
+static int compile_power_step(char **args, int n, struct power_step *step)
+{
+	const char *dev = args[1];
+	const char *action = args[2];
+	const char *value = (n > 3) ? args[3] : NULL;
+	const char *delay = NULL;
+	int n_values = 1;
+
+	if (!strcmp(dev, "cpld") && !strcmp(action, "set")) {
+		return compile_cpld_switches(args, n, step);
+	} else if (!strcmp(dev, "cpld")) {
+		const struct switch_id *sw;
+
+		for (sw = cpld_switches; sw->name != NULL; ++sw)
+			if (!strcmp(sw->name, action))
+				break;
+
+		if (sw->name == NULL)
+			return -1;
+
+		step->action = POWER_CPLD_SWITCH;
+		step->id = sw->id;
+	} else if (!strcmp(dev, "max17135") && !strcmp(action, "wait_pok")) {
+		step->action = POWER_MAX17135_WAIT_POK;
+		n_values = 0;
+	} else if (!strcmp(dev, "dac") && !strcmp(action, "output")) {
+		step->action = POWER_DAC_OUTPUT;
+	} else if (!strcmp(dev, "dac") && !strcmp(action, "power")) {
+		step->action = POWER_DAC_POWER;
+	} else {
+		return -1;
+	}
+
+	if (n > (3 + n_values + 1))
+		return -1;
+
+	if (n == (3 + n_values + 1))
+		delay = args[3 + n_values];
+
+	if (n_values) {
+		unsigned long ul_value;
+
+		if (value == NULL)
+			return -1;
+
+		if (step->action != POWER_DAC_OUTPUT) {
+			step->value = get_on_off_opt(value);
+
+			if (step->value < 0)
+				return -1;
+		} else if (!strcmp(value, "vcom")) {
+			step->value = POWER_VALUE_VCOM;
+		} else if (!parse_ul(value, &ul_value) && (ul_value <= 255)) {
+			step->value = ul_value;
+		} else {
+			return -1;
+		}
+	}
+
+	step->delay_ms = 0;
+
+	if ((delay != NULL) && parse_ul(delay, &step->delay_ms))
+		return -1;
+
+	snprintf(step->desc, sizeof(step->desc), "%s %s%s%s", dev, action,
+		 n_values ? " " : "", n_values ? value : "");
+
+	return 0;
+}
+
+/* Each step is on a line or separated with a `;', and all the steps are
+ * checked before running any of them. */
+static int compile_power_seq(const char *name, const char *text,
+			     struct power_steps *steps)
+{
+	const size_t text_size = strlen(text) + 1;
+	char *buffer = malloc(text_size);
+	char *lines = buffer;
+	char *line;
+	unsigned line_no = 0;
+	int ret = 0;
+
+	if (buffer == NULL) {
+		LOG("failed to allocate sequence buffer");
+		return -1;
+	}
+
+	memcpy(buffer, text, text_size);
+	steps->n_on = steps->n_off = 0;
+
+	while (!ret && ((line = strsep(&lines, "\n")) != NULL)) {
+		char *comment = strchr(line, '#');
+		char *step_str;
+
+		++line_no;
+
+		if (comment != NULL)
+			*comment = '\0';
+
+		while (!ret && ((step_str = strsep(&line, ";")) != NULL)) {
+			struct power_step *step;
+			size_t *n_steps;
+			char *args[12];
+			const int n = split_args(step_str, args, 12);
+
+			if (!n)
+				continue;
+
+			if ((n < 3) || (get_on_off_opt(args[0]) < 0)) {
+				ret = -1;
+				break;
+			}
+
+			if (get_on_off_opt(args[0])) {
+				step = steps->on;
+				n_steps = &steps->n_on;
+			} else {
+				step = steps->off;
+				n_steps = &steps->n_off;
+			}
+
+			if ((*n_steps == POWER_STEPS_MAX)
+			    || compile_power_step(args, n, &step[*n_steps]))
+				ret = -1;
+			else
+				++(*n_steps);
+		}
+
+		if (ret)
+			LOG("%s:%u: invalid power sequence step", name,
+			    line_no);
+	}
+
+	free(buffer);
+
+	if (!ret && (!steps->n_on || !steps->n_off)) {
+		LOG("%s: the power sequence needs on and off steps", name);
+		ret = -1;
+	}
+
+	return ret;
+}
+
+/* All the devices used by the steps are initialised before the first step.
+ * The duration of each step done is measured without its delay, including
+ * the failed one. */
+static int run_power_steps(struct ctx *ctx, const struct power_step *steps,
+			   size_t n_steps, char vcom, const char *pok_gpio,
+			   unsigned long long *durations, size_t *n_done)
+{
+	struct cpld *cpld = NULL;
+	struct max17135 *max17135 = NULL;
+	struct dac5820 *dac = NULL;
+	size_t i;
+
+	*n_done = 0;
+
+	for (i = 0; i < n_steps; ++i) {
+		switch (steps[i].action) {
+		case POWER_CPLD_SWITCH:
+		case POWER_CPLD_SWITCHES:
+			if ((cpld == NULL)
+			    && ((cpld = require_cpld(ctx)) == NULL))
+				return -1;
+			break;
+
+		case POWER_MAX17135_WAIT_POK:
+			if ((max17135 == NULL)
+			    && ((max17135 = require_max17135(ctx)) == NULL))
+				return -1;
+			break;
+
+		case POWER_DAC_OUTPUT:
+		case POWER_DAC_POWER:
+			if ((dac == NULL) && ((dac = require_dac(ctx)) == NULL))
+				return -1;
+			break;
+		}
+	}
+
+	for (i = 0; i < n_steps; ++i) {
+		const struct power_step *step = &steps[i];
+		const unsigned long long t0 = get_time_us();
+		int res = -1;
+
+		switch (step->action) {
+		case POWER_CPLD_SWITCH:
+			res = g_hw->cpld_set_switch(cpld, step->id,
+						    step->value);
+			break;
+
+		case POWER_CPLD_SWITCHES:
+			res = g_hw->cpld_set_switches(cpld, step->id,
+						      step->value);
+			break;
+
+		case POWER_MAX17135_WAIT_POK:
+			res = (pok_gpio != NULL) ?
+				wait_pok(max17135, pok_gpio) :
+				g_hw->max17135_wait_for_pok(max17135);
+			break;
+
+		case POWER_DAC_OUTPUT:
+			res = g_hw->dac5820_output(
+				dac, DAC5820_CH_A,
+				((step->value == POWER_VALUE_VCOM) ?
+				 vcom : step->value));
+			break;
+
+		case POWER_DAC_POWER:
+			res = g_hw->dac5820_set_power(
+				dac, DAC_CH, (step->value ? DAC_ON : DAC_OFF));
+			break;
+		}
+
+		durations[(*n_done)++] = get_time_us() - t0;
+
+		if (res < 0) {
+			LOG("%s failed (ERROR)", step->desc);
+			return res;
+		}
+
+		LOG("%s ok", step->desc);
+
+		if (step->delay_ms)
+			sleep_us(step->delay_ms * 1000ULL);
+	}
+
+	return 0;
+}
+
+static void report_power_steps(const struct power_step *steps,
+			       const unsigned long long *durations,
+			       size_t n_done, unsigned long long total_us)
+{
+	size_t i;
+
+	LOG_PRINT("%-32s %11s\n", "step", "time_ms");
+
+	for (i = 0; i < n_done; ++i)
+		LOG_PRINT("%-32s %11.3f\n", steps[i].desc,
+			  (durations[i] / 1000.0));
+
+	LOG_PRINT("%-32s %11.3f\n", "total", (total_us / 1000.0));
+}
+
+/* Append one line per step, including the ones skipped after a failure
+ * with an empty duration, and the header when creating the file. */
+static int save_power_steps(const char *path, const char *name, int on,
+			    const struct power_step *steps,
+			    const unsigned long long *durations,
+			    size_t n_done, size_t n_steps, int stat)
+{
+	const long now = time(NULL);
+	FILE *f = fopen(path, "a");
+	size_t i;
+	int ret = 0;
+
+	if (f == NULL)
+		return -1;
+
+	if (!ftell(f) && (fprintf(f, "time,sequence,phase,index,step,"
+				  "duration_us,result\n") < 0))
+		ret = -1;
+
+	for (i = 0; (i < n_steps) && !ret; ++i) {
+		const char *result = (i >= n_done) ? "skipped" :
+			((stat < 0) && ((i + 1) == n_done)) ? "error" : "ok";
+		int n;
+
+		if (i < n_done)
+			n = fprintf(f, "%ld,%s,%s,%zu,%s,%llu,%s\n", now,
+				    name, (on ? "on" : "off"), i,
+				    steps[i].desc, durations[i], result);
+		else
+			n = fprintf(f, "%ld,%s,%s,%zu,%s,,%s\n", now, name,
+				    (on ? "on" : "off"), i, steps[i].desc,
+				    result);
+
+		if (n < 0)
 			ret = -1;
-			break;
-		}
 	}
 
-	if (!ret)
-		LOG("All good.");
-
-	free(data_r);
-	free(data_w);
+	if (fclose(f))
+		ret = -1;
 
 	return ret;
 }
 
-static int pad_eeprom(struct eeprom *eeprom, size_t left,
-		      const struct eeprom_opt *opt)
+static const struct power_seq *get_power_seq(int argc, char **argv)
 {
-	static const size_t N_ZEROS = 64;
-	char zeros[N_ZEROS];
+	const struct power_seq *seq;
+
+	if (argc < 1) {
+		seq = &seqs[0];
+	} else {
+		const char *seq_name = argv[0];
 
-	memset(zeros, 0, N_ZEROS);
 
-	while (left) {
-		size_t n = min(N_ZEROS, left);
+		for (seq = seqs; seq->name != NULL; ++seq)
+			if (!strcmp(seq_name, seq->name))
+				break;
+
+		if (seq->name == NULL)
+			LOG("Sequence not found: %s", seq_name);
+	}
+
+	if (seq->name == NULL)
+		return NULL;
+
+	return seq;
+}
+
+/* ----------------------------------------------------------------------------
+ * ePDC
+ */
+
+static struct plep *require_epdc(struct ctx *ctx)
+{
+	if (ctx->plep == NULL)
+		ctx->plep = plep_init(NULL, NULL, NULL);
+	/* ToDo: parse options */
+
+	return ctx->plep;
+}
+
+static int epdc_get_set_hw_opt(struct ctx *ctx, int argc, char **argv)
+{
+	static const char *opt_list[_PLEP_HW_OPT_N_] = {
+		[PLEP_POWER_OFF_DELAY_MS] = "power_off_delay_ms",
+		[PLEP_CLEAR_ON_EXIT] = "clear_on_exit",
+		[PLEP_TEMPERATURE] = "temperature",
+		[PLEP_TEMPERATURE_AUTO] = "temperature_auto",
+	};
+	const char *opt_str = argv[0];
+	int opt;
+	int value;
+
+	for (opt = 0; opt < _PLEP_HW_OPT_N_; ++opt) {
+		if (!strcmp(opt_list[opt], opt_str))
+			break;
+	}
+
+	if (opt == _PLEP_HW_OPT_N_) {
+		LOG("Invalid hardware option identifier: %s", opt_str);
+		return -1;
+	}
+
+	if (argc == 1) {
+		if (plep_get_hw_opt(ctx->plep, opt, &value)) {
+			LOG("Error getting ePDC opt %s", opt_str);
+			return -1;
+		}
 
-		log_eeprom_progress(opt->data_size, (left - n), "Padding");
+		LOG("ePDC opt %s: %d", opt_str, value);
+	} else {
+		value = atoi(argv[1]);
 
-		if (eeprom_write(eeprom, zeros, n) < 0)
+		if (plep_set_hw_opt(ctx->plep, opt, value)) {
+			LOG("Error setting ePDC opt %s", opt_str);
 			return -1;
+		}
 
-		left -= n;
+		LOG("ePDC opt %s set to: %d", opt_str, value);
 	}
 
 	return 0;
 }
 
-static int rw_file_eeprom(struct eeprom *eeprom, int fd, int write_file,
-			  const struct eeprom_opt *opt)
+static int run_epdc(struct ctx *ctx, int argc, char **argv)
 {
-	static const size_t buffer_size = 4096;
-	const char *msg = write_file ? "Reading" : "Writing";
-	char *buffer = malloc(buffer_size);
-	size_t left;
-	int ret;
+	struct plep *plep = require_epdc(ctx);
+	const char *cmd;
+	int stat;
 
-	left = opt->data_size;
+	if (plep == NULL)
+		return -1;
 
-	if (buffer == NULL) {
-		LOG("failed to allocate buffer");
+	if (argc < 2) {
+		LOG("Invalid arguments");
 		return -1;
 	}
 
-	eeprom_seek(eeprom, opt->skip);
-	ret = 0;
+	cmd = argv[0];
 
-	while (left && !ret && !g_abort) {
-		const size_t rwsz =
-			(left > buffer_size) ? buffer_size : left;
+	if (!strcmp(cmd, "opt")) {
+		stat = epdc_get_set_hw_opt(ctx, (argc - 1), &argv[1]);
+	} else {
+		LOG("Unsupported command");
+		stat = -1;
+	}
 
-		if (write_file) {
-			log_eeprom_progress(opt->data_size, left - rwsz, msg);
+	return stat;
+}
 
-			if (eeprom_read(eeprom, buffer, rwsz) < 0)
-				ret = -1;
-			else if (write(fd, buffer, rwsz) < 0)
-				ret = -1;
+/* ----------------------------------------------------------------------------
+ * Digests
+ */
 
-			left -= rwsz;
-		} else {
-			const ssize_t rdsz = read(fd, buffer, rwsz);
+/* -- CRC32C (Castagnoli) -- */
 
-			if (rdsz >= 0)
-				log_eeprom_progress(opt->data_size,
-						    (left - rdsz), msg);
+static uint32_t crc32c_table[256];
+static pthread_once_t crc32c_table_once = PTHREAD_ONCE_INIT;
 
-			if (rdsz < 0) {
-				ret = -1;
-			} else if (eeprom_write(eeprom, buffer, rdsz) < 0) {
-				ret = -1;
-			} else if ((size_t) rdsz == rwsz) {
-				left -= rwsz;
-			} else {
-				if (opt->zero_padding) {
-					LOG_PRINT("\n");
-					left -= rdsz;
-					ret = pad_eeprom(eeprom, left, opt);
-				}
+static void crc32c_init_table(void)
+{
+	uint32_t i;
 
-				left = 0;
-			}
-		}
-	}
+	for (i = 0; i < 256; ++i) {
+		uint32_t crc = i;
+		int bit;
 
-	LOG_PRINT("\n");
-	free(buffer);
+		for (bit = 0; bit < 8; ++bit)
+			crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78 : 0);
 
-	return ret;
+		crc32c_table[i] = crc;
+	}
 }
 
-static int parse_eeprom_opt(struct ctx *ctx, struct eeprom_opt *eopt)
+#if defined(__x86_64__) && defined(__GNUC__)
+/* SSE4.2 has a CRC32C instruction, used when the CPU supports it */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_update_hw(uint32_t crc, const char *data, size_t size)
 {
-	const size_t opt_size = strlen(g_opt) + 1;
-	static const char *sep = ", ";
-	char *opt_str;
-	char *opt;
-	int ret = 0;
+	uint64_t crc64 = crc;
 
-	opt_str = malloc(opt_size);
-	assert(opt_str != NULL);
-	memcpy(opt_str, g_opt, opt_size);
+	for (; size && ((uintptr_t) data & 7); --size)
+		crc64 = __builtin_ia32_crc32qi(crc64, *data++);
 
-	while ((opt = strsep(&opt_str, sep)) != NULL) {
-		static const char *opt_sep = "=";
-		char *key;
-		char *str_value;
-		unsigned long ul_value;
-		int is_int;
+	for (; size >= 8; size -= 8, data += 8) {
+		uint64_t word;
 
-		key = strsep(&opt, opt_sep);
+		memcpy(&word, data, 8);
+		crc64 = __builtin_ia32_crc32di(crc64, word);
+	}
 
-		if (key == NULL) {
-			LOG("invalid EEPROM option");
-			return -1;
-		}
+	for (; size; --size)
+		crc64 = __builtin_ia32_crc32qi(crc64, *data++);
 
-		str_value = strsep(&opt, opt_sep);
+	return crc64;
+}
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+static uint32_t crc32c_update_hw(uint32_t crc, const char *data, size_t size)
+{
+	for (; size >= 8; size -= 8, data += 8) {
+		uint64_t word;
 
-		if (str_value) {
-			errno = 0;
-			ul_value = strtoul(str_value, NULL, 10);
-			is_int = errno ? 0 : 1;
-		} else {
-			is_int = 0;
-		}
+		memcpy(&word, data, 8);
+		crc = __crc32cd(crc, word);
+	}
 
-		if (!strcmp(key, "i2c_block_size")) {
-			if (!is_int) {
-				LOG("no or invalid I2C block size");
-				ret = -1;
-				goto exit_now;
-			}
+	for (; size; --size)
+		crc = __crc32cb(crc, *data++);
 
-			LOG("I2C block size: %lu", ul_value);
-			eopt->block_size = ul_value;
-		} else if (!strcmp(key, "page_size")) {
-			if (!is_int) {
-				LOG("no or invalid EEPROM page size");
-				ret = -1;
-				goto exit_now;
-			}
+	return crc;
+}
+#endif
 
-			LOG("EEPROM page size: %lu", ul_value);
-			eopt->page_size = ul_value;
-		} else if (!strcmp(key, "zero_padding")) {
-			LOG("zero-padding enabled");
-			eopt->zero_padding = 1;
-		} else if (!strcmp(key, "data_size")) {
-			if (!is_int) {
-				LOG("no or invalid data size");
-				ret = -1;
-				goto exit_now;
-			}
+static void crc32c_init(union digest_ctx *ctx)
+{
+	pthread_once(&crc32c_table_once, crc32c_init_table);
+	ctx->crc32c = 0xFFFFFFFF;
+}
 
-			LOG("data size: %lu", ul_value);
-			eopt->data_size = ul_value;
-		} else if (!strcmp(key, "skip")) {
-			if (!is_int) {
-				LOG("no or invalid skip size specified");
-				ret = -1;
-				goto exit_now;
-			}
+static void crc32c_update(union digest_ctx *ctx, const char *data,
+			  size_t size)
+{
+	uint32_t crc = ctx->crc32c;
 
-			LOG("skip: %lu", ul_value);
-			eopt->skip = ul_value;
-		} else if (!strcmp(key, "addr")) {
-			if (str_value == NULL) {
-				LOG("no I2C address configuration specified");
-				ret = -1;
-				goto exit_now;
-			}
+#if defined(__x86_64__) && defined(__GNUC__)
+	if (__builtin_cpu_supports("sse4.2")) {
+		ctx->crc32c = crc32c_update_hw(crc, data, size);
+		return;
+	}
+#elif defined(__ARM_FEATURE_CRC32)
+	ctx->crc32c = crc32c_update_hw(crc, data, size);
+	return;
+#endif
 
-			eopt->i2c_addr = plconfig_get_i2c_addr(
-				ctx->config, str_value, PLHW_NO_I2C_ADDR);
+	while (size--)
+		crc = (crc >> 8) ^ crc32c_table[(crc ^ *data++) & 0xFF];
 
-			if (eopt->i2c_addr != PLHW_NO_I2C_ADDR) {
-				LOG("I2C address (%s): 0x%02X",
-				    str_value, eopt->i2c_addr);
-			} else {
-				LOG("failed to find I2C address in config: %s",
-				    str_value);
-			}
-		} else {
-			LOG("invalid option name: %s", key);
-			ret = -1;
-			goto exit_now;
-		}
+	ctx->crc32c = crc;
+}
+
+static void crc32c_final(union digest_ctx *ctx, unsigned char *digest)
+{
+	const uint32_t crc = ~ctx->crc32c;
+
+	digest[0] = crc >> 24;
+	digest[1] = crc >> 16;
+	digest[2] = crc >> 8;
+	digest[3] = crc;
+}
+
+/* -- SHA-256 -- */
+
+static const uint32_t SHA256_K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(struct sha256_ctx *s, const unsigned char *block)
+{
+	uint32_t w[64];
+	uint32_t a, b, c, d, e, f, g, h;
+	int i;
+
+	for (i = 0; i < 16; ++i)
+		w[i] = ((uint32_t) block[i * 4] << 24)
+			| ((uint32_t) block[i * 4 + 1] << 16)
+			| ((uint32_t) block[i * 4 + 2] << 8)
+			| block[i * 4 + 3];
+
+	for (i = 16; i < 64; ++i) {
+		const uint32_t s0 = ROTR32(w[i - 15], 7)
+			^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		const uint32_t s1 = ROTR32(w[i - 2], 17)
+			^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
 	}
 
-exit_now:
-	free(opt_str);
+	a = s->h[0]; b = s->h[1]; c = s->h[2]; d = s->h[3];
+	e = s->h[4]; f = s->h[5]; g = s->h[6]; h = s->h[7];
 
-	return ret;
+	for (i = 0; i < 64; ++i) {
+		const uint32_t t1 = h + (ROTR32(e, 6) ^ ROTR32(e, 11)
+					 ^ ROTR32(e, 25))
+			+ ((e & f) ^ (~e & g)) + SHA256_K[i] + w[i];
+		const uint32_t t2 = (ROTR32(a, 2) ^ ROTR32(a, 13)
+				     ^ ROTR32(a, 22))
+			+ ((a & b) ^ (a & c) ^ (b & c));
+
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+
+	s->h[0] += a; s->h[1] += b; s->h[2] += c; s->h[3] += d;
+	s->h[4] += e; s->h[5] += f; s->h[6] += g; s->h[7] += h;
 }
 
-static void log_eeprom_progress(size_t total, size_t rem, const char *msg)
+#undef ROTR32
+
+static void sha256_init(union digest_ctx *ctx)
 {
-	const size_t prog = total - rem;
-	const int prog_percent = prog * 100 / total;
+	static const uint32_t H0[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
 
-	LOG_PRINT("\r%s EEPROM... %i%% (%zu)", msg, prog_percent, prog);
+	memcpy(ctx->sha256.h, H0, sizeof(H0));
+	ctx->sha256.len = 0;
 }
 
-/* ----------------------------------------------------------------------------
- * Power
- */
-
-static int run_power(struct ctx *ctx, int argc, char **argv)
+static void sha256_update(union digest_ctx *ctx, const char *data,
+			  size_t size)
 {
-	const struct power_seq *seq;
-	int stat;
-	int on;
+	struct sha256_ctx *s = &ctx->sha256;
+	size_t used = s->len % 64;
 
-	if (argc < 1) {
-		LOG("invalid arguments");
-		return -1;
-	}
+	s->len += size;
 
-	on = get_on_off_opt(argv[0]);
+	if (used) {
+		const size_t n = min((64 - used), size);
 
-	if (on < 0) {
-		LOG("invalid arguments (possible values are `on' or `off')");
-		return -1;
-	}
+		memcpy(&s->buf[used], data, n);
+		data += n;
+		size -= n;
 
-	seq = get_power_seq(argc - 1, argv + 1);
+		if ((used + n) < 64)
+			return;
 
-	if (seq == NULL)
-		return -1;
+		sha256_block(s, s->buf);
+	}
 
-	if (on) {
-		/* ToDo: get the VCOM as floating point in volts */
-		char vcom = 128;
+	for (; size >= 64; size -= 64, data += 64)
+		sha256_block(s, (const unsigned char *) data);
 
-		if (argc > 2) {
-			const int vcom_raw = atoi(argv[2]);
+	memcpy(s->buf, data, size);
+}
 
-			if ((vcom_raw < 0) || (vcom_raw > 255))
-				LOG("invalid vcom value (valid range: 0-255)");
-			else
-				vcom = (char) vcom_raw;
-		}
+static void sha256_final(union digest_ctx *ctx, unsigned char *digest)
+{
+	struct sha256_ctx *s = &ctx->sha256;
+	const uint64_t bits = s->len * 8;
+	size_t used = s->len % 64;
+	int i;
 
-		stat = seq->on(ctx, vcom);
-	} else {
-		stat = seq->off(ctx);
+	s->buf[used++] = 0x80;
+
+	if (used > 56) {
+		memset(&s->buf[used], 0, (64 - used));
+		sha256_block(s, s->buf);
+		used = 0;
 	}
 
-	if (!stat)
-		LOG("Power %s", on ? "on" : "off");
+	memset(&s->buf[used], 0, (56 - used));
 
-	return stat;
+	for (i = 0; i < 8; ++i)
+		s->buf[56 + i] = bits >> (56 - (i * 8));
+
+	sha256_block(s, s->buf);
+
+	for (i = 0; i < 32; ++i)
+		digest[i] = s->h[i / 4] >> (24 - ((i % 4) * 8));
 }
 
-#define STEP(cmd, msg) do {			\
-		const int res = (cmd);			\
-		if (res < 0) {				\
-			LOG(msg" failed (ERROR)");	\
-			return res;			\
-		} else {				\
-			LOG(msg" ok");			\
-		}					\
-	} while (0)
+/* -- xxHash (XXH64, seed 0) -- */
 
-static int power_on_seq0(struct ctx *ctx, char vcom)
-{
-	struct cpld *cpld = require_cpld(ctx);
-	struct max17135 *max17135 = require_max17135(ctx);
-	struct dac5820 *dac = require_dac(ctx);
+static const uint64_t XXH_P1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t XXH_P2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t XXH_P3 = 0x165667B19E3779F9ULL;
+static const uint64_t XXH_P4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t XXH_P5 = 0x27D4EB2F165667C5ULL;
 
-	if ((cpld == NULL) || (max17135 == NULL))
-		return -1;
+#define ROTL64(x, n) (((x) << (n)) | ((x) >> (64 - (n))))
+
+static uint64_t xxh64_read64(const unsigned char *p)
+{
+	uint64_t v = 0;
+	int i;
 
-	STEP(cpld_set_switch(cpld, CPLD_BPCOM_CLAMP, 1), "BPCOM clamp");
-	STEP(cpld_set_switch(cpld, CPLD_HVEN, 1), "HV enable");
-	STEP(max17135_wait_for_pok(max17135), "wait for POK");
-	STEP(cpld_set_switch(cpld, CPLD_COM_SW_CLOSE, 0), "COM open");
-	STEP(cpld_set_switch(cpld, CPLD_COM_SW_EN, 1), "COM enable");
-	STEP(cpld_set_switch(cpld, CPLD_COM_PSU, 1), "COM PSU on");
-	STEP(dac5820_output(dac, DAC5820_CH_A, vcom), "VCOM DAC value");
-	STEP(dac5820_set_power(dac, DAC_CH, DAC_ON), "DAC power on");
-	STEP(cpld_set_switch(cpld, CPLD_COM_SW_CLOSE, 1), "COM close");
+	for (i = 7; i >= 0; --i)
+		v = (v << 8) | p[i];
 
-	return 0;
+	return v;
 }
 
-static int power_off_seq0(struct ctx *ctx)
+static uint64_t xxh64_round(uint64_t acc, uint64_t input)
 {
-	struct cpld *cpld = require_cpld(ctx);
-	struct dac5820 *dac = require_dac(ctx);
+	acc += input * XXH_P2;
+	acc = ROTL64(acc, 31);
 
-	if (cpld == NULL)
-		return -1;
+	return acc * XXH_P1;
+}
 
-	STEP(cpld_set_switch(cpld, CPLD_COM_SW_CLOSE, 0), "COM open");
-	STEP(cpld_set_switch(cpld, CPLD_COM_SW_EN, 0), "COM disable");
-	STEP(dac5820_set_power(dac, DAC_CH, DAC_OFF), "DAC power off");
-	STEP(cpld_set_switch(cpld, CPLD_COM_PSU, 0), "COM PSU off");
-	STEP(cpld_set_switch(cpld, CPLD_HVEN, 0), "HV disable");
+static uint64_t xxh64_merge(uint64_t acc, uint64_t val)
+{
+	acc ^= xxh64_round(0, val);
 
-	return 0;
+	return (acc * XXH_P1) + XXH_P4;
 }
 
-#undef STEP
+static void xxh64_stripe(struct xxh64_ctx *x, const unsigned char *p)
+{
+	int i;
+
+	for (i = 0; i < 4; ++i)
+		x->v[i] = xxh64_round(x->v[i], xxh64_read64(&p[i * 8]));
+}
 
-static const struct power_seq *get_power_seq(int argc, char **argv)
+static void xxh64_init(union digest_ctx *ctx)
 {
-	const struct power_seq *seq;
+	struct xxh64_ctx *x = &ctx->xxh64;
 
-	if (argc < 1) {
-		seq = &seqs[0];
-	} else {
-		const char *seq_name = argv[0];
+	x->v[0] = XXH_P1 + XXH_P2;
+	x->v[1] = XXH_P2;
+	x->v[2] = 0;
+	x->v[3] = -XXH_P1;
+	x->len = 0;
+}
 
+static void xxh64_update(union digest_ctx *ctx, const char *data,
+			 size_t size)
+{
+	struct xxh64_ctx *x = &ctx->xxh64;
+	size_t used = x->len % 32;
 
-		for (seq = seqs; seq->name != NULL; ++seq)
-			if (!strcmp(seq_name, seq->name))
-				break;
+	x->len += size;
 
-		if (seq->name == NULL)
-			LOG("Sequence not found: %s", seq_name);
-	}
+	if (used) {
+		const size_t n = min((32 - used), size);
 
-	if (seq->name == NULL)
-		return NULL;
+		memcpy(&x->buf[used], data, n);
+		data += n;
+		size -= n;
 
-	return seq;
-}
+		if ((used + n) < 32)
+			return;
 
-/* ----------------------------------------------------------------------------
- * ePDC
- */
+		xxh64_stripe(x, x->buf);
+	}
 
-static struct plep *require_epdc(struct ctx *ctx)
-{
-	if (ctx->plep == NULL)
-		ctx->plep = plep_init(NULL, NULL, NULL);
-	/* ToDo: parse options */
+	for (; size >= 32; size -= 32, data += 32)
+		xxh64_stripe(x, (const unsigned char *) data);
 
-	return ctx->plep;
+	memcpy(x->buf, data, size);
 }
 
-static int epdc_get_set_hw_opt(struct ctx *ctx, int argc, char **argv)
+static void xxh64_final(union digest_ctx *ctx, unsigned char *digest)
 {
-	static const char *opt_list[_PLEP_HW_OPT_N_] = {
-		[PLEP_POWER_OFF_DELAY_MS] = "power_off_delay_ms",
-		[PLEP_CLEAR_ON_EXIT] = "clear_on_exit",
-		[PLEP_TEMPERATURE] = "temperature",
-		[PLEP_TEMPERATURE_AUTO] = "temperature_auto",
-	};
-	const char *opt_str = argv[0];
-	int opt;
-	int value;
+	struct xxh64_ctx *x = &ctx->xxh64;
+	const unsigned char *p = x->buf;
+	size_t left = x->len % 32;
+	uint64_t h;
+	int i;
 
-	for (opt = 0; opt < _PLEP_HW_OPT_N_; ++opt) {
-		if (!strcmp(opt_list[opt], opt_str))
-			break;
-	}
+	if (x->len >= 32) {
+		h = ROTL64(x->v[0], 1) + ROTL64(x->v[1], 7)
+			+ ROTL64(x->v[2], 12) + ROTL64(x->v[3], 18);
 
-	if (opt == _PLEP_HW_OPT_N_) {
-		LOG("Invalid hardware option identifier: %s", opt_str);
-		return -1;
+		for (i = 0; i < 4; ++i)
+			h = xxh64_merge(h, x->v[i]);
+	} else {
+		h = XXH_P5;
 	}
 
-	if (argc == 1) {
-		if (plep_get_hw_opt(ctx->plep, opt, &value)) {
-			LOG("Error getting ePDC opt %s", opt_str);
-			return -1;
-		}
+	h += x->len;
 
-		LOG("ePDC opt %s: %d", opt_str, value);
-	} else {
-		value = atoi(argv[1]);
+	for (; left >= 8; left -= 8, p += 8) {
+		h ^= xxh64_round(0, xxh64_read64(p));
+		h = (ROTL64(h, 27) * XXH_P1) + XXH_P4;
+	}
 
-		if (plep_set_hw_opt(ctx->plep, opt, value)) {
-			LOG("Error setting ePDC opt %s", opt_str);
-			return -1;
-		}
+	if (left >= 4) {
+		const uint64_t k = (uint64_t) p[0] | ((uint64_t) p[1] << 8)
+			| ((uint64_t) p[2] << 16) | ((uint64_t) p[3] << 24);
 
-		LOG("ePDC opt %s set to: %d", opt_str, value);
+		h ^= k * XXH_P1;
+		h = (ROTL64(h, 23) * XXH_P2) + XXH_P3;
+		left -= 4;
+		p += 4;
 	}
 
-	return 0;
+	for (; left; --left, ++p) {
+		h ^= *p * XXH_P5;
+		h = ROTL64(h, 11) * XXH_P1;
+	}
+
+	h ^= h >> 33;
+	h *= XXH_P2;
+	h ^= h >> 29;
+	h *= XXH_P3;
+	h ^= h >> 32;
+
+	for (i = 0; i < 8; ++i)
+		digest[i] = h >> (56 - (i * 8));
 }
 
-static int run_epdc(struct ctx *ctx, int argc, char **argv)
+#undef ROTL64
+
+static const struct digest_algo digest_algos[] = {
+	{ "crc32c", 4, crc32c_init, crc32c_update, crc32c_final },
+	{ "sha256", 32, sha256_init, sha256_update, sha256_final },
+	{ "xxh64", 8, xxh64_init, xxh64_update, xxh64_final },
+	{ NULL },
+};
+
+static const struct digest_algo *get_digest_algo(const char *name)
 {
-	struct plep *plep = require_epdc(ctx);
-	const char *cmd;
-	int stat;
+	const struct digest_algo *algo;
 
-	if (plep == NULL)
-		return -1;
+	for (algo = digest_algos; algo->name != NULL; ++algo)
+		if (!strcmp(algo->name, name))
+			return algo;
 
-	if (argc < 2) {
-		LOG("Invalid arguments");
-		return -1;
-	}
+	LOG("invalid digest algorithm: %s", name);
 
-	cmd = argv[0];
+	return NULL;
+}
 
-	if (!strcmp(cmd, "opt")) {
-		stat = epdc_get_set_hw_opt(ctx, (argc - 1), &argv[1]);
-	} else {
-		LOG("Unsupported command");
-		stat = -1;
+/* The string needs to hold (size * 2 + 1) characters */
+static void digest_to_str(const unsigned char *digest, size_t size,
+			  char *str)
+{
+	static const char HEX[] = "0123456789abcdef";
+
+	while (size--) {
+		*str++ = HEX[*digest >> 4];
+		*str++ = HEX[*digest++ & 0xF];
 	}
 
-	return stat;
+	*str = '\0';
 }
 
 /* ----------------------------------------------------------------------------
@@ -2088,34 +8440,248 @@ static int get_on_off_opt(const char *on_off)
 	return -1;
 }
 
-static void dump_hex_data(const char *data, size_t size)
+static int split_args(char *line, char **argv, int max_args)
 {
-	size_t n_lines;
-	size_t remaining = size;
-	const char *byte;
-	unsigned line;
+	char *it = line;
+	int argc = 0;
 
-	if (!size)
-		return;
+	for (;;) {
+		char *out;
+		char quote;
 
-	n_lines = size / 16;
+		while ((*it == ' ') || (*it == '\t') || (*it == '\r')
+		       || (*it == '\n'))
+			++it;
 
-	if (size % 16)
-		++n_lines;
+		if ((*it == '\0') || (*it == '#'))
+			break;
 
-	for (line = 0, byte = data; line < n_lines; ++line) {
-		const int length = (remaining < 16) ? remaining : 16;
-		int i;
+		if (argc == max_args)
+			return -1;
 
-		if (line && !(line % 16))
-			LOG_PRINT("\n");
+		argv[argc++] = out = it;
+		quote = '\0';
+
+		while (*it != '\0') {
+			if (quote != '\0') {
+				if (*it == quote)
+					quote = '\0';
+				else
+					*out++ = *it;
+			} else if ((*it == '"') || (*it == '\'')) {
+				quote = *it;
+			} else if ((*it == ' ') || (*it == '\t')
+				   || (*it == '\r') || (*it == '\n')) {
+				break;
+			} else {
+				*out++ = *it;
+			}
+
+			++it;
+		}
+
+		if (quote != '\0')
+			return -1;
+
+		if (*it != '\0')
+			++it;
+
+		*out = '\0';
+	}
+
+	return argc;
+}
+
+static int parse_ul(const char *str, unsigned long *value)
+{
+	char *end;
+
+	errno = 0;
+	*value = strtoul(str, &end, 0);
+
+	if (errno || (end == str) || (*end != '\0'))
+		return -1;
+
+	return 0;
+}
+
+static int parse_ul_list(const char *str, unsigned long *values, size_t max)
+{
+	const size_t str_size = strlen(str) + 1;
+	char *buf = malloc(str_size);
+	char *it = buf;
+	char *item;
+	size_t n = 0;
+
+	assert(buf != NULL);
+	memcpy(buf, str, str_size);
+
+	while ((item = strsep(&it, ":")) != NULL) {
+		if ((n == max) || parse_ul(item, &values[n])) {
+			free(buf);
+			return -1;
+		}
+
+		++n;
+	}
+
+	free(buf);
+
+	return n;
+}
+
+static ssize_t read_full(int fd, char *data, size_t size)
+{
+	size_t done = 0;
+
+	while (done < size) {
+		const ssize_t n = read(fd, &data[done], (size - done));
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		if (!n)
+			break;
+
+		done += n;
+	}
+
+	return done;
+}
+
+static int write_full(int fd, const char *data, size_t size)
+{
+	while (size) {
+		const ssize_t n = write(fd, data, size);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		data += n;
+		size -= n;
+	}
+
+	return 0;
+}
+
+static unsigned long long get_time_us(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec * 1000000ULL) + (now.tv_nsec / 1000);
+}
+
+static unsigned long long get_time_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec * 1000000000ULL) + now.tv_nsec;
+}
+
+static void sleep_us(unsigned long long us)
+{
+	struct timespec t;
+
+	t.tv_sec = us / 1000000;
+	t.tv_nsec = (us % 1000000) * 1000;
+
+	while (nanosleep(&t, &t) && (errno == EINTR) && !g_abort);
+}
+
+/* Fast hash of a 64-bit value, used as a random number generator which can
+ * produce any number of its sequence directly. */
+static uint64_t splitmix64(uint64_t x)
+{
+	x += 0x9E3779B97F4A7C15ULL;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+
+	return x ^ (x >> 31);
+}
+
+/* Format up to 16 bytes like `hexdump -C' and return the line length, at
+ * most HEX_LINE_SIZE including the new line but without a terminating
+ * null character. */
+static size_t format_hex_line(char *out, size_t offset, const char *data,
+			      size_t size)
+{
+	char *it = out;
+	size_t i;
+	int shift;
+
+	for (shift = 28; shift >= 0; shift -= 4)
+		*it++ = HEX_DIGITS[(offset >> shift) & 0xF];
+
+	*it++ = ' ';
+
+	for (i = 0; i < 16; ++i) {
+		if (!(i % 8))
+			*it++ = ' ';
+
+		if (i < size) {
+			const unsigned char byte = data[i];
+
+			*it++ = HEX_DIGITS[byte >> 4];
+			*it++ = HEX_DIGITS[byte & 0xF];
+		} else {
+			*it++ = ' ';
+			*it++ = ' ';
+		}
+
+		*it++ = ' ';
+	}
 
-		for (i = 0; i < length; ++i)
-			LOG_PRINT("%02X ", *byte++);
+	*it++ = ' ';
+	*it++ = '|';
 
-		LOG_PRINT("\b\n");
-		remaining -= length;
+	for (i = 0; i < size; ++i)
+		*it++ = ((data[i] >= 0x20) && (data[i] < 0x7F)) ?
+			data[i] : '.';
+
+	*it++ = '|';
+	*it++ = '\n';
+
+	return it - out;
+}
+
+/* The whole dump is formatted first and then printed in one go */
+static void dump_hex_data(const char *data, size_t size)
+{
+	const size_t n_lines = (size + 15) / 16;
+	char *text;
+	char *it;
+	size_t offset;
+
+	if (!size)
+		return;
+
+	text = malloc((n_lines * HEX_LINE_SIZE) + 1);
+	it = text;
+
+	if (text == NULL) {
+		LOG("failed to allocate buffer");
+		return;
 	}
+
+	for (offset = 0; offset < size; offset += 16)
+		it += format_hex_line(it, offset, &data[offset],
+				      min(16, (size - offset)));
+
+	*it = '\0';
+	LOG_PRINT("%s", text);
+	free(text);
 }
 
 /* ----------------------------------------------------------------------------
@@ -2135,7 +8701,14 @@ static const char help_cpld[] =
 "    vcom_psu:     VCOM power supply enable\n"
 "    bpcom_clamp:  BPCOM clamp enable\n"
 "  Other:\n"
-"    version:      Get the CPLD version number (plain decimal on stdout)\n";
+"    version:      Get the CPLD version number (plain decimal on stdout)\n"
+"    set SWITCH=on|off [SWITCH=on|off...]:\n"
+"                  Set several switches in one command, after checking\n"
+"                  all the names.  On the hardware, the switches are set\n"
+"                  one at a time with one transfer each, as libplhw has\n"
+"                  no way to write them at once, so this is no faster\n"
+"                  than setting them separately.  Only the sim backend\n"
+"                  uses a single transfer.\n";
 
 static const char help_max17135[] =
 "  With no arguments, all the status information is dumped.\n"
@@ -2186,15 +8759,63 @@ static const char help_adc[] =
 "    vcom: read the VCOM value on its dedicated channel\n";
 
 static const char help_pbtn[] =
-"  No arguments, just a small procedure to manually test the buttons.\n";
+"  No arguments, just a small procedure to manually test the buttons.\n"
+"  Options follow this format:\n"
+"    -o gpio=CHIP:LINE[:active_low]\n"
+"  and wait for an edge on the GPIO expander interrupt line with the GPIO\n"
+"  character device, then read the buttons once, instead of polling them.\n"
+"  CHIP is a /dev/gpiochipN device, or use fd:N to wait for data on the\n"
+"  open file descriptor N instead.  The default is the pbtn-gpio value from\n"
+"  plsdk.ini.\n";
 
 static const char help_eeprom[] =
 "  The first argument is the EEPROM mode, which is typically 24c01 for\n"
 "  128 bytes or 24c256 for 32 KBytes.  Then the second argument is one of\n"
 "  the following commands:\n"
-"    full_rw:        write random data, read it back and compare\n"
+"    full_rw:        write a test pattern, read it back and compare it,\n"
+"                    then report the bit flips of each page with errors\n"
+"    bench:          measure the read and write speed with a range of block\n"
+"                    sizes, page sizes and transfer lengths, and print the\n"
+"                    results as tab-separated values on stdout.  The\n"
+"                    write cycle wait is the write time minus the read\n"
+"                    time with the same length and block size.  The data\n"
+"                    at skip is saved first and restored at the end, in\n"
+"                    whole pages of the biggest page size tested.\n"
+"    probe:          find the largest I2C block size accepted by the bus\n"
+"                    and the actual EEPROM page size, then print them as\n"
+"                    the -o option string to use with the other commands.\n"
+"                    The page size is probed by writing random data in an\n"
+"                    area at skip which is saved first and restored.\n"
 "    e2f FILE_NAME:  dump EEPROM contents to a file, or stdout by default\n"
 "    f2e FILE_NAME:  dump file contents or stdin by default to EEPROM\n"
+"    verify FILE_NAME: compare the EEPROM contents with a file or stdin by\n"
+"                    default, and fail if any page is different\n"
+"    get [FIELD]:    print a field of the display data header found at\n"
+"                    skip, or all the fields when none is given.  Only\n"
+"                    the bytes of the field are read.  The fields are\n"
+"                    panel_id, panel_type, vcom, waveform_md5,\n"
+"                    waveform_full_length, waveform_lzss_length,\n"
+"                    waveform_id and waveform_target.\n"
+"    set FIELD VALUE: write a field of the display data header and update\n"
+"                    the header CRC, without writing the other fields.\n"
+"                    It fails if the CRC is already invalid, unless the\n"
+"                    force option is used.\n"
+"    fill PATTERN:   write PATTERN over the data_size bytes at skip, with\n"
+"                    whole pages aligned on the page boundaries.  PATTERN\n"
+"                    is either a byte value such as 0xFF to erase the\n"
+"                    EEPROM, or a test pattern name as with the pattern\n"
+"                    option.  With diff, the pages already filled are not\n"
+"                    written again.\n"
+"    sum [ALGO [DIGEST]]:\n"
+"                    print the digest of the EEPROM contents with ALGO,\n"
+"                    which is crc32c (default), sha256 or xxh64.  When\n"
+"                    DIGEST is provided, fail if it is different.\n"
+"    gang FILE_NAME BUS[@ADDR] [BUS[@ADDR]...]:\n"
+"                    write the file to several EEPROMs at the same time\n"
+"                    with one thread per target, then verify each of them\n"
+"                    and print a PASS or FAIL line per target.  ADDR is\n"
+"                    in hexadecimal as with -a, and the default address\n"
+"                    is the one from the addr option or -a.\n"
 "  Options follow this format:\n"
 "    -o option1=value1,option2=value2\n"
 "  Supported options are:\n"
@@ -2202,6 +8823,7 @@ static const char help_eeprom[] =
 "      Maximum I2C block transfer size in bytes.  The default is 96, which\n"
 "      should work with all I2C bus drivers, but it can be increased to 512\n"
 "      for example in order to speed-up the data transfers when available.\n"
+"      The probe command finds the largest value for a given bus.\n"
 "    page_size=SIZE\n"
 "      EEPROM page size.  A default page size is set based on the EEPROM\n"
 "      mode, but each manufacturer may implement different page sizes.  This\n"
@@ -2210,7 +8832,73 @@ static const char help_eeprom[] =
 "      Enable padding of the end of the EEPROM data with zeros, when writing\n"
 "      the contents of a file smaller than the EEPROM capacity.  This is\n"
 "      especially useful when storing plain text to ensure the data is well\n"
-"      null-terminated.\n"
+"      null-terminated.  The padding is written with whole pages, and only\n"
+"      the pages which are not already zero with diff.\n"
+"    buffer_size=SIZE\n"
+"      Size of the chunks of data transferred between the file and the\n"
+"      EEPROM, 4096 by default.  Regular files are mapped in memory and\n"
+"      transferred directly in chunks aligned with the EEPROM pages, other\n"
+"      files such as pipes and stdin or stdout use a buffer of this size.\n"
+"    pipeline[=N]\n"
+"      Transfer the data between the file and the EEPROM with a separate\n"
+"      thread for the file I/O, which exchanges N buffers of buffer_size\n"
+"      bytes (2 by default) with the EEPROM transfers.  This makes the file\n"
+"      I/O happen at the same time as the I2C transfers, which is faster\n"
+"      with slow files such as network paths or compression pipes.\n"
+"    compress[=gzip|rle|none]\n"
+"      Compress the data with gzip when dumping the EEPROM to a file, and\n"
+"      decompress it when writing it to the EEPROM.  This is enabled by\n"
+"      default with file names ending with .gz, and always uses pipelined\n"
+"      transfers.  With rle, only runs of identical bytes are compressed,\n"
+"      which is faster and still efficient with padding.  The output is a\n"
+"      regular gzip file in both cases.  The end of the decompressed data\n"
+"      is used to start the zero_padding.\n"
+"    hexdump\n"
+"      With e2f, write a hexdump of the EEPROM data with the offsets and\n"
+"      the ASCII characters instead of the raw data.  This can be combined\n"
+"      with compress.\n"
+"    force\n"
+"      With set, update the display data header even when its CRC is\n"
+"      already invalid, and write a new CRC.\n"
+"    pattern=NAME\n"
+"      Test pattern used by full_rw, one of random (default), walking for\n"
+"      walking ones, address for the address bits in the data, or checker\n"
+"      for a checkerboard.  The data is generated again when reading it\n"
+"      back, so full_rw only uses two buffers of buffer_size bytes.\n"
+"    seed=N\n"
+"      Seed of the random pattern, based on the time by default.  The\n"
+"      seed is logged by full_rw and bench so a test can be run again with\n"
+"      the same data.\n"
+"    journal=FILE\n"
+"      When writing a regular file to the EEPROM, save the progress in\n"
+"      FILE after each chunk of buffer_size bytes along with the SHA-256 of\n"
+"      the image.  The journal is removed when the transfer is complete.\n"
+"    resume\n"
+"      Continue the transfer from the offset saved in the journal, if the\n"
+"      image and the EEPROM area are the same.  The data already written\n"
+"      is read back and checked with a quick hash first.\n"
+"    ranges=OFFSET+SIZE:OFFSET+SIZE:...\n"
+"      Only transfer the given ranges of the EEPROM, instead of skip and\n"
+"      data_size, with e2f, f2e and verify.  The file must be a regular file\n"
+"      with the same offsets as the EEPROM, typically a full image.  The\n"
+"      ranges which overlap or are adjacent are merged, and when reading\n"
+"      the ranges are extended to whole pages first.\n"
+"    layout=FILE\n"
+"      Add the ranges listed in FILE, with one OFFSET SIZE [NAME] range\n"
+"      per line and text following a `#' ignored.\n"
+"    cache=DIR\n"
+"      Keep a copy of the EEPROM data in DIR for each display data header\n"
+"      found at skip.  With e2f, only the header is read when there is\n"
+"      already a copy for it, otherwise the EEPROM is read once to create\n"
+"      it.  With f2e, the file becomes the copy for the new header when it\n"
+"      covers the whole data_size area, or the copy is removed.  The cache\n"
+"      assumes the data does not change as long as the header is the same,\n"
+"      so it can not be used with the other commands, nor with ranges,\n"
+"      journal, hexdump or compression.\n"
+"    diff\n"
+"      When writing to the EEPROM, read each page first and only write the\n"
+"      pages with different contents.  This is faster when most of the data\n"
+"      is already correct, and saves EEPROM write cycles.\n"
 "    skip=SIZE\n"
 "      Skip SIZE bytes from the EEPROM when either reading or writing.\n"
 "    data_size=SIZE\n"
@@ -2220,7 +8908,15 @@ static const char help_eeprom[] =
 "      Look for the CONFIG option in the plsdk.ini file and use this as the\n"
 "      I2C address to communicate with the EEPROM.  The CONFIG key is used\n"
 "      as-is and there is no naming convention; typical values are\n"
-"      eeprom-i2c-addr-display and eeprom-i2c-addr-vcom.\n";
+"      eeprom-i2c-addr-display and eeprom-i2c-addr-vcom.\n"
+"    bench_blocks=SIZE:SIZE:...\n"
+"    bench_pages=SIZE:SIZE:...\n"
+"    bench_lengths=SIZE:SIZE:...\n"
+"      Lists of I2C block sizes, page sizes and transfer lengths to use with\n"
+"      the bench command.  By default, block sizes from 16 to 512 are used\n"
+"      along with page sizes around the default one for the EEPROM mode.\n"
+"      The page sizes for which the write results show a mismatch are not\n"
+"      supported by the EEPROM.\n";
 
 static const char help_power[] =
 "  Supported arguments:\n"
@@ -2228,7 +8924,55 @@ static const char help_power[] =
 "      turn the power on, with optional sequence name (seq0 by default) and\n"
 "      optional VCOM register value (decimal, range varies with seq type)\n"
 "    off [seq]\n"
-"      turn the power off\n";
+"      turn the power off\n"
+"  The sequence is either seq0, the path to a sequence file when it\n"
+"  contains a `/', or the power-seq-NAME value from plsdk.ini.  This value\n"
+"  contains either the steps, or the path to a sequence file when it starts\n"
+"  with a `/'.  The steps are on separate lines or separated with a `;',\n"
+"  with text following a `#' ignored, and in this format:\n"
+"    on|off DEVICE ACTION [VALUE] [DELAY_MS]\n"
+"  The first word tells whether the step is part of the power on or power\n"
+"  off sequence, and the steps are run in the order they are listed.  Once\n"
+"  the step is done, the sequence waits for DELAY_MS milliseconds.  The\n"
+"  supported actions are:\n"
+"    cpld SWITCH on|off   with the switches of the cpld command\n"
+"    cpld set SWITCH=on|off [SWITCH=on|off...]\n"
+"                         set several switches in one step, when they do\n"
+"                         not need to be in a given order; on the\n"
+"                         hardware this is no faster than one step per\n"
+"                         switch\n"
+"    max17135 wait_pok    wait for the HV power to be OK\n"
+"    dac output VALUE     set the VCOM DAC value, 0-255 or vcom for the\n"
+"                         value given to power on\n"
+"    dac power on|off     turn the VCOM DAC output on or off\n"
+"  For example, with this line in plsdk.ini:\n"
+"    power-seq-hv = on cpld hv on 10; on max17135 wait_pok; off cpld hv off\n"
+"  the `power on hv' command only turns the HV on and waits for POK.\n"
+"  The time taken by each step, without its delay, is printed at the end\n"
+"  along with the total time.  Options follow this format:\n"
+"    -o csv=FILE,pok_gpio=CHIP:LINE[:active_low]\n"
+"  The csv option appends the time of each step to the FILE in CSV format,\n"
+"  with the time when the sequence was run, the sequence name, the phase,\n"
+"  the step index and description, the duration in microseconds and the\n"
+"  result.  The pok_gpio option makes max17135 wait_pok wait for the POK\n"
+"  line to be active with the GPIO character device, then read the POK\n"
+"  status once, instead of polling it.  It is given as with the pbtn gpio\n"
+"  option, and the default is the pok-gpio value from plsdk.ini.\n";
+
+static const char help_serve[] =
+"  Keep all the devices open and run commands received on a Unix domain\n"
+"  socket until Ctrl-C is pressed.  The optional argument is the socket\n"
+"  path, otherwise the serve-socket value from plsdk.ini is used or\n"
+"  /tmp/plhwtools.sock by default:\n"
+"    serve [SOCKET_PATH]\n"
+"  Each request is one line with a COMMAND_NAME and its COMMAND_ARGUMENTS,\n"
+"  optionally starting with `-o COMMAND_OPTIONS'.  The command output is\n"
+"  sent back followed by a line with either [ok] or [error].  Requests from\n"
+"  all the clients are run one at a time so they never share the bus, for\n"
+"  example:\n"
+"    echo \"adc internal vcom\" | socat - UNIX-CONNECT:/tmp/plhwtools.sock\n"
+"  The requests have no standard input, so the commands which read data\n"
+"  need a file name and the confirmation prompts always abort.\n";
 
 static const char help_epdc[] =
 "  This command is used to access the low-level interface to electrophoretic\n"